@@ -26,9 +26,10 @@ Created by: Matthieu Pinard, Ecole des Mines de Saint-Etienne, matthieu.pinard@e
 #include <atomic>
 #include <thread>
 
-// Constants used for the Lock. The uint_fast32_t is standard (as of C99), can be used with std::atomic<> and at least 32 bits.
-const uint_fast32_t EMPTY = 0x00000000, POPULATED = 0x80000000;
-const uint_fast32_t VALUE_BITS_MASK = 0x80000000, WRITER_BIT_MASK = 0x40000000, READER_COUNT_MASK = 0x3FFFFFFF;
+// Constants used for the Lock. The uint_fast64_t is standard (as of C99), can be used with std::atomic<> and at least 64 bits.
+const uint_fast64_t EMPTY = 0x00000000, POPULATED = 0x80000000;
+const uint_fast64_t VALUE_BITS_MASK = 0x80000000, WRITER_BIT_MASK = 0x40000000, META_BITS_MASK = 0x3FF00000, READER_COUNT_MASK = 0x000FFFFF;
+const uint_fast64_t VERSION_MASK = 0xFFFFFFFF00000000, VERSION_INCREMENT = 0x0000000100000000;
 
 /*! \class AtomicLock
 * \brief Class for locking objects, working like a Read-Write Lock (allowing multiple Readers but a single Writer, at the cost of a certain overhead).
@@ -38,14 +39,15 @@ const uint_fast32_t VALUE_BITS_MASK = 0x80000000, WRITER_BIT_MASK = 0x40000000,
 */
 class AtomicRWLock {
 private:
-	std::atomic<uint_fast32_t> ThisLock; /*!< The atomic variable containing the Lock state, including its value (EMPTY or POPULATED) in VALUE_BITS, whether the Lock is acquired for Writing or not
-										 (WRITER_BIT) and the spin count (READER_COUNT)
-										 0	 2	 3		     31
-										 |-------|-------|-------------------|
-										 |VALUE	 |WRITER |READER_COUNT       |
-										 |BITS	 |BIT	 |		     |
-										 |		 |		     |					
-										 |-------|-------|-------------------|
+	std::atomic<uint_fast64_t> ThisLock; /*!< The atomic variable containing the Lock state, including the number of Write operations modulo 2^32 (VERSION), its value (EMPTY or POPULATED)
+										 in VALUE_BITS, whether the Lock is acquired for Writing or not (WRITER_BIT), metadata owned by the Lock user (META_BITS) and the spin count (READER_COUNT)
+										 0		     32	     33	     34		 44		     63
+										 |-------------------|-------|-------|-----------|-------------------|
+										 |VERSION	     |VALUE	 |WRITER |META	     |READER_COUNT       |
+										 |		     |BITS	 |BIT	 |BITS	     |		         |
+										 |		     |		 |		 |		     |		         |
+										 |-------------------|-------|-------|-----------|-------------------|
+										 An optimistic read only validates torn data if 2^32 Write operations happen meanwhile, and the READER_COUNT never overflows into the META_BITS, as read_lock() waits while it is full.
 										 */
 public:
 	/*!
@@ -55,24 +57,49 @@ public:
 	*  As soon as it is released, the write_lock() function tries to acquire the Lock for writing, and wait for potential Readers before returning.
 	*
 	*/
-	inline uint_fast32_t write_lock();
+	inline uint_fast64_t write_lock();
 	/*!
 	*  \brief Release the AtomicLock, and store the value passed as argument in the VALUE_BITS.
 	*/
-	inline void write_unlock(const uint_fast32_t);
+	inline void write_unlock(const uint_fast64_t);
 	/*!
 	*  \brief Acquire the AtomicLock for reading, so no other subsequent Write operations can occur, and return the Lock stored VALUE_BITS.
 	*
-	*  This methods spins while the AtomicLock is acquired for writing by another thread.
+	*  This methods spins while the AtomicLock is acquired for writing by another thread, or while the READER_COUNT is at its maximum.
 	*  As soon as it is released, the read_lock() function increments the READER_COUNT.
 	*
 	*/
-	inline uint_fast32_t read_lock();
+	inline uint_fast64_t read_lock();
 	/*!
 	*  \brief Decrements the READER_COUNT.
 	*/
 	inline void read_unlock();
 	/*!
+	*  \brief Start an optimistic Read operation, which does not write to the AtomicRWLock, and return the Lock state.
+	*
+	*  This methods spins while the AtomicLock is acquired for writing by another thread.
+	*  The data read afterwards is only consistent if read_validate() succeeds with the returned Lock state.
+	*
+	*/
+	inline uint_fast64_t read_begin() const;
+	/*!
+	*  \brief Check whether an optimistic Read operation started with read_begin() was concurrent with a Write operation.
+	*
+	*  \return true if no Write operation has occured since read_begin() returned the Lock state passed as argument,
+	*  false otherwise.
+	*/
+	inline bool read_validate(const uint_fast64_t) const;
+	/*!
+	*  \brief Return the META_BITS of the AtomicRWLock.
+	*/
+	inline uint_fast64_t meta() const;
+	/*!
+	*  \brief Replace the META_BITS by the desired ones if they are equal to the expected ones, whether the AtomicRWLock is acquired or not.
+	*
+	*  \return true if the META_BITS have been replaced, false otherwise : the expected META_BITS are then updated with the current ones.
+	*/
+	inline bool compare_exchange_meta(uint_fast64_t&, const uint_fast64_t);
+	/*!
 	*  \brief AtomicLock constructors.
 	*
 	*  The contructor initializes the AtomicLock as empty and released for Writing and Reading.
@@ -87,12 +114,12 @@ public:
 	~AtomicRWLock() {}
 };
 
-inline uint_fast32_t AtomicRWLock::read_lock() {
+inline uint_fast64_t AtomicRWLock::read_lock() {
 	do {
 		// Spin on atomic reading for speed.
 		auto OldLock = ThisLock.load(std::memory_order_acquire);
-		// If the Lock is available... (ie. no threads have locked it for writing)
-		if (!(OldLock & WRITER_BIT_MASK)) {
+		// If the Lock is available... (ie. no threads have locked it for writing, and the READER_COUNT can be incremented)
+		if (!(OldLock & WRITER_BIT_MASK) && (OldLock & READER_COUNT_MASK) != READER_COUNT_MASK) {
 			// Increment the READER_COUNT using a CAS-operation.
 			if (ThisLock.compare_exchange_strong(OldLock, OldLock + 1, std::memory_order_acquire, std::memory_order_relaxed)) {
 				// Return the VALUE_BITS.
@@ -104,7 +131,7 @@ inline uint_fast32_t AtomicRWLock::read_lock() {
 	} while (true);
 }
 
-inline uint_fast32_t AtomicRWLock::write_lock()
+inline uint_fast64_t AtomicRWLock::write_lock()
 {
 	do {
 		// Spin on atomic reading for speed.
@@ -117,6 +144,8 @@ inline uint_fast32_t AtomicRWLock::write_lock()
 				// Wait for the Readers before acquiring the Lock for writing.
 				while (ThisLock.load(std::memory_order_acquire) & READER_COUNT_MASK)
 					std::this_thread::yield();
+				// Optimistic Readers seeing any subsequent write will also see the WRITER_BIT in read_validate().
+				std::atomic_thread_fence(std::memory_order_release);
 				// Return the VALUE_BITS.
 				return OldLock & VALUE_BITS_MASK;
 			}
@@ -126,9 +155,12 @@ inline uint_fast32_t AtomicRWLock::write_lock()
 	} while (true);
 }
 
-inline void AtomicRWLock::write_unlock(const uint_fast32_t X) {
-	// Set the VALUE_BITS (whether the Slot is POPULATED or EMPTY)
-	ThisLock.store(X, std::memory_order_release);
+inline void AtomicRWLock::write_unlock(const uint_fast64_t X) {
+	// Set the VALUE_BITS (whether the Slot is POPULATED or EMPTY), and increment the VERSION.
+	// No Reader can increment the READER_COUNT meanwhile, as the WRITER_BIT is set, but the META_BITS may be replaced.
+	auto OldLock = ThisLock.load(std::memory_order_relaxed);
+	while (!ThisLock.compare_exchange_weak(OldLock, X | (OldLock & META_BITS_MASK) | ((OldLock + VERSION_INCREMENT) & VERSION_MASK),
+										   std::memory_order_release, std::memory_order_relaxed));
 }
 
 inline void AtomicRWLock::read_unlock() {
@@ -136,27 +168,81 @@ inline void AtomicRWLock::read_unlock() {
 	ThisLock.fetch_sub(1, std::memory_order_release);
 }
 
+inline uint_fast64_t AtomicRWLock::read_begin() const {
+	do {
+		auto OldLock = ThisLock.load(std::memory_order_acquire);
+		// If the Lock is available... (ie. no threads have locked it for writing)
+		if (!(OldLock & WRITER_BIT_MASK)) {
+			return OldLock;
+		}
+		// Yield between two checks.
+		std::this_thread::yield();
+	} while (true);
+}
+
+inline bool AtomicRWLock::read_validate(const uint_fast64_t OldLock) const {
+	// Order the previous reads of the data before reading the Lock state again.
+	std::atomic_thread_fence(std::memory_order_acquire);
+	auto NewLock = ThisLock.load(std::memory_order_relaxed);
+	// The READER_COUNT is not relevant, but the WRITER_BIT and the VERSION are.
+	return (NewLock & ~READER_COUNT_MASK) == (OldLock & ~READER_COUNT_MASK);
+}
+
+inline uint_fast64_t AtomicRWLock::meta() const {
+	return ThisLock.load(std::memory_order_acquire) & META_BITS_MASK;
+}
+
+inline bool AtomicRWLock::compare_exchange_meta(uint_fast64_t& Expected, const uint_fast64_t Desired) {
+	auto OldLock = ThisLock.load(std::memory_order_relaxed);
+	do {
+		if ((OldLock & META_BITS_MASK) != Expected) {
+			Expected = OldLock & META_BITS_MASK;
+			return false;
+		}
+		// Retry while the other bits change, as the Lock may be acquired or released meanwhile.
+	} while (!ThisLock.compare_exchange_weak(OldLock, (OldLock & ~META_BITS_MASK) | Desired, std::memory_order_acq_rel, std::memory_order_relaxed));
+	return true;
+}
+
 /*! \class ReadWrapper
 * \brief RAII class for Read operations on an AtomicRWLock.
 *
 */
 class ReadWrapper {
 private:
-	uint_fast32_t Val; /*!< The Lock stored value */
-	AtomicRWLock& Lck; /*!< The Lock as a reference */
+	uint_fast64_t Val; /*!< The Lock stored value */
+	AtomicRWLock* pLck; /*!< The Lock as a pointer, nullptr if no Lock is held */
 public:
 	/*!
 	*  \brief ReadWrapper constructor.
 	*
 	*  The contructor locks the Lock passed as argument for Reading and stores the returned value.
 	*/
-	ReadWrapper(AtomicRWLock& _Lck) : Lck(_Lck) {
-		Val = Lck.read_lock();
+	ReadWrapper(AtomicRWLock& _Lck) : pLck(&_Lck) {
+		Val = pLck->read_lock();
 	}
 	/*!
+	*  \brief ReadWrapper constructors, holding no Lock or taking over the Lock held by another ReadWrapper.
+	*/
+	ReadWrapper() : Val(EMPTY), pLck(nullptr) {}
+	ReadWrapper(ReadWrapper&& Other) : Val(Other.Val), pLck(Other.pLck) {
+		Other.pLck = nullptr;
+	}
+	ReadWrapper& operator= (ReadWrapper&& Other) {
+		if (pLck) {
+			pLck->read_unlock();
+		}
+		Val = Other.Val;
+		pLck = Other.pLck;
+		Other.pLck = nullptr;
+		return *this;
+	}
+	ReadWrapper(const ReadWrapper&) = delete;
+	ReadWrapper& operator= (const ReadWrapper&) = delete;
+	/*!
 	*  \brief Getter/Setter for the Lock stored value.
 	*/
-	uint_fast32_t& operator() () {
+	uint_fast64_t& operator() () {
 		return Val;
 	}
 	/*!
@@ -165,7 +251,9 @@ public:
 	*  The destructor unlocks the Lock passed as argument for Reading.
 	*/
 	~ReadWrapper() {
-		Lck.read_unlock();
+		if (pLck) {
+			pLck->read_unlock();
+		}
 	}
 };
 
@@ -175,21 +263,39 @@ public:
 */
 class WriteWrapper {
 private:
-	uint_fast32_t Val; /*!< The Lock stored value */
-	AtomicRWLock& Lck; /*!< The Lock as a reference */
+	uint_fast64_t Val; /*!< The Lock stored value */
+	AtomicRWLock* pLck; /*!< The Lock as a pointer, nullptr if no Lock is held */
 public:
 	/*!
 	*  \brief WriteWrapper constructor.
 	*
 	*  The contructor locks the Lock passed as argument for Writing and stores the returned value.
 	*/
-	WriteWrapper(AtomicRWLock& _Lck) : Lck(_Lck) {
-		Val = Lck.write_lock();
+	WriteWrapper(AtomicRWLock& _Lck) : pLck(&_Lck) {
+		Val = pLck->write_lock();
 	}
 	/*!
+	*  \brief WriteWrapper constructors, holding no Lock or taking over the Lock held by another WriteWrapper.
+	*/
+	WriteWrapper() : Val(EMPTY), pLck(nullptr) {}
+	WriteWrapper(WriteWrapper&& Other) : Val(Other.Val), pLck(Other.pLck) {
+		Other.pLck = nullptr;
+	}
+	WriteWrapper& operator= (WriteWrapper&& Other) {
+		if (pLck) {
+			pLck->write_unlock(Val);
+		}
+		Val = Other.Val;
+		pLck = Other.pLck;
+		Other.pLck = nullptr;
+		return *this;
+	}
+	WriteWrapper(const WriteWrapper&) = delete;
+	WriteWrapper& operator= (const WriteWrapper&) = delete;
+	/*!
 	*  \brief Getter/Setter for the Lock stored value.
 	*/
-	uint_fast32_t& operator() () {
+	uint_fast64_t& operator() () {
 		return Val;
 	}
 	/*!
@@ -198,6 +304,8 @@ public:
 	*  The destructor unlocks the Lock passed as argument for Writing.
 	*/
 	~WriteWrapper() {
-		Lck.write_unlock(Val);
+		if (pLck) {
+			pLck->write_unlock(Val);
+		}
 	}
 };
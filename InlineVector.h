@@ -0,0 +1,177 @@
+/*
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Created by: Matthieu Pinard, Ecole des Mines de Saint-Etienne, matthieu.pinard@etu.emse.fr
+15-05-2016: Initial release
+*/
+
+#pragma once
+
+/*!
+* \file InlineVector.h
+* \brief Vector storing its first elements inline, before spilling to the heap.
+* \author Matthieu Pinard
+*/
+#include <vector>
+#include <memory>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+/*! \class InlineVector
+* \brief Vector storing up to N elements within the object itself.
+*
+*  The elements are stored contiguously : inline while there are at most N of them, in a heap-allocated std::vector otherwise.
+*  Once spilled, the elements stay on the heap until the InlineVector is empty again.
+*/
+template <class T, size_t N, class Alloc = std::allocator<T> >
+class InlineVector {
+	static_assert(N > 0U, "InlineVector requires an inline capacity of at least one element.");
+private:
+	typename std::aligned_storage<sizeof(T), alignof(T)>::type InlineData[N]; /*!< The inline storage */
+	size_t InlineCount; /*!< The number of elements stored inline */
+	std::vector<T, Alloc> HeapData; /*!< The heap storage, used once more than N elements have been stored */
+	/*!
+	*  \brief Returns a pointer to the inline storage.
+	*/
+	inline T* InlineBegin() {
+		return reinterpret_cast<T*>(&InlineData[0]);
+	}
+	inline const T* InlineBegin() const {
+		return reinterpret_cast<const T*>(&InlineData[0]);
+	}
+	/*!
+	*  \brief Moves the inline elements to the heap storage.
+	*/
+	void Spill() {
+		HeapData.reserve(2 * N + 1);
+		for (size_t Idx = 0U; Idx < InlineCount; ++Idx) {
+			HeapData.push_back(std::move(InlineBegin()[Idx]));
+			InlineBegin()[Idx].~T();
+		}
+		InlineCount = 0U;
+	}
+public:
+	typedef T* iterator;
+	typedef const T* const_iterator;
+	/*!
+	*  \brief InlineVector constructors.
+	*/
+	InlineVector() : InlineCount(0U) {}
+	InlineVector(const InlineVector& Other) : InlineCount(0U), HeapData(Other.HeapData) {
+		for (size_t Idx = 0U; Idx < Other.InlineCount; ++Idx) {
+			new (InlineBegin() + Idx) T(Other.InlineBegin()[Idx]);
+		}
+		InlineCount = Other.InlineCount;
+	}
+	InlineVector(InlineVector&& Other) : InlineCount(0U), HeapData(std::move(Other.HeapData)) {
+		for (size_t Idx = 0U; Idx < Other.InlineCount; ++Idx) {
+			new (InlineBegin() + Idx) T(std::move(Other.InlineBegin()[Idx]));
+		}
+		InlineCount = Other.InlineCount;
+		Other.clear();
+	}
+	InlineVector& operator= (InlineVector Other) {
+		clear();
+		HeapData = std::move(Other.HeapData);
+		for (size_t Idx = 0U; Idx < Other.InlineCount; ++Idx) {
+			new (InlineBegin() + Idx) T(std::move(Other.InlineBegin()[Idx]));
+		}
+		InlineCount = Other.InlineCount;
+		return *this;
+	}
+	/*!
+	*  \brief InlineVector destructor.
+	*/
+	~InlineVector() {
+		clear();
+	}
+	/*!
+	*  \brief Returns whether the elements are stored inline.
+	*/
+	inline bool is_inline() const {
+		return HeapData.empty();
+	}
+	/*!
+	*  \brief Returns the inline storage and the number of elements stored inline, whether the elements are stored inline or not.
+	*/
+	inline const T* inline_begin() const {
+		return InlineBegin();
+	}
+	inline size_t inline_size() const {
+		return InlineCount;
+	}
+	inline size_t size() const {
+		return is_inline() ? InlineCount : HeapData.size();
+	}
+	inline bool empty() const {
+		return !size();
+	}
+	inline iterator begin() {
+		return is_inline() ? InlineBegin() : HeapData.data();
+	}
+	inline iterator end() {
+		return begin() + size();
+	}
+	inline const_iterator begin() const {
+		return is_inline() ? InlineBegin() : HeapData.data();
+	}
+	inline const_iterator end() const {
+		return begin() + size();
+	}
+	inline T& operator[] (size_t Idx) {
+		return begin()[Idx];
+	}
+	inline const T& operator[] (size_t Idx) const {
+		return begin()[Idx];
+	}
+	inline T& back() {
+		return end()[-1];
+	}
+	/*!
+	*  \brief Constructs an element at the end of the InlineVector, spilling the elements to the heap if the inline storage is full.
+	*/
+	template <class... Args>
+	inline void emplace_back(Args&&... args) {
+		if (is_inline() && InlineCount < N) {
+			new (InlineBegin() + InlineCount) T(std::forward<Args>(args)...);
+			++InlineCount;
+			return;
+		}
+		if (is_inline()) {
+			Spill();
+		}
+		HeapData.emplace_back(std::forward<Args>(args)...);
+	}
+	inline void push_back(const T& Val) {
+		emplace_back(Val);
+	}
+	inline void push_back(T&& Val) {
+		emplace_back(std::move(Val));
+	}
+	inline void pop_back() {
+		if (is_inline()) {
+			InlineBegin()[--InlineCount].~T();
+		}
+		else {
+			HeapData.pop_back();
+		}
+	}
+	inline void clear() {
+		while (InlineCount) {
+			InlineBegin()[--InlineCount].~T();
+		}
+		HeapData.clear();
+	}
+};
@@ -23,18 +23,10 @@ Created by: Matthieu Pinard, Ecole des Mines de Saint-Etienne, matthieu.pinard@e
 * \brief Define Hash function specialization for std::basic_string, std::pair, pointers and types castable to size_t.
 * \author Matthieu Pinard
 */
+#include <cstddef>
+#include <string>
+#include <utility>
 
-/*! \class LayeredHash
-* \brief The Hasher class used in LayeredHashMap.
-*/
-template <typename __T>
-class LayeredHash {
-public:
-	inline size_t operator() (__T const& Key) const {
-		return _Hash(Key);
-	}
-};
-
 // Castable to size_t.
 template <typename __T>
 inline size_t _Hash(__T const& Key) {
@@ -44,7 +36,7 @@ inline size_t _Hash(__T const& Key) {
 // Pointers.
 template <typename __T>
 inline size_t _Hash(__T* Key) {
-	return reinterpret_cast<size_t>(ptr);
+	return reinterpret_cast<size_t>(Key);
 }
 
 // Basic_string
@@ -64,4 +56,15 @@ inline size_t _Hash(std::basic_string<charT, traits, Alloc> const& String) {
 template <typename __X, typename __Y>
 inline size_t _Hash(std::pair<__X, __Y> const& Pair) {
 	return _Hash(Pair.first) ^ _Hash(Pair.second);
-}
\ No newline at end of file
+}
+
+/*! \class LayeredHash
+* \brief The Hasher class used in LayeredHashMap.
+*/
+template <typename __T>
+class LayeredHash {
+public:
+	inline size_t operator() (__T const& Key) const {
+		return _Hash(Key);
+	}
+};
\ No newline at end of file
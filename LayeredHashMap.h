@@ -19,9 +19,7 @@ Created by: Matthieu Pinard, Ecole des Mines de Saint-Etienne, matthieu.pinard@e
 #pragma once
 
 // to do :                            
-// AllocateLayer() in MT context    
 // Move & Copy CTORs
-// Safe iterator() 
 
 /*!
 * \file LayeredHashMap.h
@@ -30,77 +28,43 @@ Created by: Matthieu Pinard, Ecole des Mines de Saint-Etienne, matthieu.pinard@e
 */
 #include "LayeredHashMapMathematics.h"
 #include "LayeredHash.h"
-#include "AtomicRWLock.h"
-#include "ThreadManager\ThreadManager.h"
+#include "SlotPolicies.h"
+#include "ThreadManager/ThreadManager.h"
 #include <memory>
 #include <array>
 #include <functional>
-#include <list>
+#include <type_traits>
+#include <tuple>
+#include <algorithm>
+#include <utility>
+#include <iterator>
+#include <vector>
+#include <stdexcept>
 
-#define MAX_INSTANCE_COUNT 1024
+// Number of Slots migrated by each call to Write, Read or Delete while a migration is pending.
+#define MIGRATION_STEP 8
 
-template<class T>
-class InitalizedVector {
-private:
-	std::vector<T> Data;
-public:
-	template<class U>
-	explicit InitalizedVector(U* pU) {
-		Data.reserve(MAX_INSTANCE_COUNT);
-		for (auto i = 0U; i < MAX_INSTANCE_COUNT; ++i) {
-			Data.emplace_back(*(pU + i));
-		}
-	}
-	T& operator[] (size_t Idx) {
-		return Data[Idx];
-	}
-};
+// The top Layer is released when the size falls below SHRINK_LOAD_FACTOR times the capacity of the remaining Layers.
+// As the next Layer is allocated when the size exceeds the capacity of the Layers, this prevents grow / shrink thrashing.
+#define SHRINK_LOAD_FACTOR 0.5
 
-template<class T>
-class ConcurrentList {
-private:
-	std::list<T> Data;
-	AtomicLock Lock;
-public:
-	ConcurrentList() {
-		for (auto i = 0U; i < MAX_INSTANCE_COUNT; ++i) {
-			Data.push_front(i);
-		}
-	}
-	inline void push_front (const T& Val) {
-		std::lock_guard<AtomicLock> lock(Lock);
-		Data.push_front(Val);
-	}
-	inline void push_front(T&& Val) {
-		std::lock_guard<AtomicLock> lock(Lock);
-		Data.push_front(Val);
-	}
-	inline T pop_front() {
-		std::lock_guard<AtomicLock> lock(Lock);
-		T Ret = Data.front();
-		Data.pop_front();
-		return Ret;
-	}
-};
-
-// Allocate a static list of values {0 ... MAX_INSTANCE_COUNT - 1} so LayeredHashMap constructor can pick out an index in the 
-// to bind to a free ThreadManager/ThreadValues... This is concurrency-safe.
-static ConcurrentList<size_t> AvailableInstanceIdx;
+// Number of Keys whose home Slots are prefetched at once by MultiRead.
+#ifndef MULTI_READ_GROUP
+#define MULTI_READ_GROUP 16
+#endif
 
-// Allocate a static array of ThreadManager of size MAX_INSTANCE_COUNT, so multiple instances of the LayeredHashMap can be used at once.
-static std::array<ThreadManager, MAX_INSTANCE_COUNT> Managers;
-
-// Allocate a vector of ThreadValues per thread using the thread_local keyword.
-// The number of ThreadValues per thread is equal to MAX_INSTANCE_COUNT, and they are initialized so that
-// the i-th ThreadValue is bound to the i-th ThreadManager.
-static thread_local InitalizedVector<ThreadValue> Values(&Managers[0]);
+// Number of Slots taken at once by each thread of ParallelForEach and ParallelReduce.
+#ifndef PARALLEL_WALK_CHUNK
+#define PARALLEL_WALK_CHUNK 4096
+#endif
 
 /*! \class LayeredHashMap
 * \brief Class implementing the HashMap.
 *
 *  The class provides with Read, Write, Delete, and Size retrieval capabilities.
+*  The layout of the KeyValues within the Slots is given by the Policy : ChainingPolicy or OpenAddressingPolicy (see SlotPolicies.h).
 */
-template <class K, class T, class Hash = LayeredHash<K>, class Pred = std::equal_to<K>, class Alloc = std::allocator<K> >
+template <class K, class T, class Hash = LayeredHash<K>, class Pred = std::equal_to<K>, class Alloc = std::allocator<K>, class Policy = ChainingPolicy>
 class LayeredHashMap
 {
 	// Allocator typedef to rebind Alloc to other types
@@ -112,39 +76,228 @@ class LayeredHashMap
 	// 2-D vector = array of vector
 	template<typename __T>
 	using ArrayVector = std::array<Vector<__T>, MaxLayerCount>;
+	// Slot engine definition, given by the Policy
+	typedef typename Policy::template Engine<K, T, Pred, Alloc> Engine;
 	// Pair definition
-	typedef std::pair<K, T> Pair;
+	typedef typename Engine::Pair Pair;
 	// Slot definition
-	struct Slot {
-		AtomicRWLock Lock; // Read-Write Lock
-		Pair Main;  // Main KeyValue
-		Vector<Pair> Collisions; // Collided KeyValues
+	typedef typename Engine::Slot Slot;
+	// Locked home Slot definition
+	typedef typename Engine::Home Home;
+	// Optimistic reads copy the KeyValue while it may be written, which is only safe for trivially-copyable Keys and Values.
+	static constexpr bool OptimisticReads = std::is_trivially_copyable<K>::value && std::is_trivially_copyable<T>::value;
+	// RAII class marking the thread as using the Layers, so none of them is freed until it is released (see ThreadManager::WaitForOptimisticReads()).
+	struct LayerUser {
+		ThreadValue* pThrValue;
+		LayerUser(ThreadValue& ThrValue) : pThrValue(&ThrValue) {
+			ThrValue.BeginOptimisticRead();
+		}
+		LayerUser(const LayerUser&) = delete;
+		LayerUser& operator= (const LayerUser&) = delete;
+		inline void Release() {
+			if (pThrValue) {
+				pThrValue->EndOptimisticRead();
+				pThrValue = nullptr;
+			}
+		}
+		~LayerUser() {
+			Release();
+		}
+	};
+public:
+	/*! \class SlotAccessor
+	* \brief RAII class giving access to a stored KeyValue, whose Slot stays locked for as long as the SlotAccessor holds it.
+	*
+	*  Wrapper is either ReadWrapper (ConstAccessor : the Value is read-only) or WriteWrapper (Accessor : the Value can be modified in place).
+	*  While the KeyValue is held, its Slot cannot be migrated : the holding thread must not call any other method of the LayeredHashMap.
+	*/
+	template <class Wrapper>
+	class SlotAccessor {
+		friend class LayeredHashMap;
+		typedef typename std::conditional<std::is_same<Wrapper, ReadWrapper>::value, const T, T>::type ValueType;
+		Wrapper Lock; // While the Slot is locked, it cannot be migrated, so its Layer is not released
+		Pair* pKeyVal;
+	public:
+		SlotAccessor() : pKeyVal(nullptr) {}
+		SlotAccessor(const SlotAccessor&) = delete;
+		SlotAccessor& operator= (const SlotAccessor&) = delete;
+		/*!
+		*  \brief Returns whether a KeyValue is held.
+		*/
+		inline bool Empty() const {
+			return !pKeyVal;
+		}
+		/*!
+		*  \brief Returns the held Key and Value.
+		*/
+		inline K const& Key() const {
+			return pKeyVal->first;
+		}
+		inline ValueType& operator* () const {
+			return pKeyVal->second;
+		}
+		inline ValueType* operator-> () const {
+			return &pKeyVal->second;
+		}
+		/*!
+		*  \brief Unlocks the Slot of the held KeyValue, if any.
+		*/
+		inline void Release() {
+			pKeyVal = nullptr;
+			Lock = Wrapper();
+		}
 	};
+	typedef SlotAccessor<ReadWrapper> ConstAccessor;
+	typedef SlotAccessor<WriteWrapper> Accessor;
 private:
 	ArrayVector<Slot> Slots; /*!< A ArrayVector (ie. bidimensional) containing the Slots */
-	const size_t InstanceIdx;  /*!< The variable containing the index of this HashMap instance. (0 to MAX_INSTANCE_COUNT - 1) */
-	size_t LayerLastIdx; /*!< The variable containing the last used Vector index in the HashMap */
+	ArrayVector<AtomicFingerprint> Fingerprints; /*!< A ArrayVector containing the fingerprints of the Slots, if the Policy uses them */
+	ThreadManager Manager; /*!< The ThreadManager summing the sizes stored within each thread of execution, see GetSize() */
+	std::atomic<size_t> LayerState; /*!< The versioned Layer state, packing into a single word (so it is published at once):
+									- the last used Vector index in the HashMap (LAST_IDX),
+									- the last used Vector index the elements were hashed with before the current migration (MIGRATION_IDX, equal to LAST_IDX when no migration is pending),
+									- the index of the current migration, incremented each time a migration starts (EPOCH) */
+	size_t MigrationCursor; /*!< The raw hash of the next Slot to be migrated */
+	AtomicLock MigrationLock; /*!< The Lock ensuring a single thread migrates Slots at a given time */
+	std::atomic<size_t> MigrationCredit; /*!< The number of Slots left to the migrating thread by the threads which could not migrate them */
+	std::atomic<size_t> WalkerCount; /*!< The number of walks over the Slots in progress, during which no migration is started */
+	std::atomic<bool> ResizeRequested; /*!< Whether the ThreadManager found the global value out of the "goal" global values, see TryResize() */
+	size_t MinLayerIdx; /*!< The last Layer index allocated by the constructor, below which the Layers are not released automatically */
+	// State of the last snapshot taken.
+	struct SnapshotState {
+		std::atomic<size_t> Epoch; // Twice the number of snapshots completed, plus one while a snapshot is in progress, see SNAPSHOT_MARK_MASK
+		AtomicLock Lock; // Lock protecting the KeyValues
+		std::vector<std::pair<K, T> > KeyVals; // KeyValues copied so far
+	};
+	// The writers only test the Epoch word : whether a snapshot is in progress and which one cannot be read apart.
+	SnapshotState LastSnapshot; /*!< The state of the last snapshot taken */
+	AtomicLock SnapshotLock; /*!< The Lock ensuring a single snapshot is taken at a given time */
+	typename Engine::Shared Shared; /*!< The data shared by all the Slots, as defined by the Policy */
+	// Pack and unpack the Layer state : a Layer index fits in LAYER_BITS bits as MaxLayerCount <= 64.
+	#define LAYER_BITS				6
+	#define LAYER_MASK				((size_t(1) << LAYER_BITS) - 1)
+	#define LAYER_STATE(LastIdx, MigrationIdx, Epoch)	((size_t(Epoch) << (2 * LAYER_BITS)) | (size_t(MigrationIdx) << LAYER_BITS) | size_t(LastIdx))
+	#define LAST_IDX(State)			((State) & LAYER_MASK)
+	#define MIGRATION_IDX(State)	(((State) >> LAYER_BITS) & LAYER_MASK)
+	#define EPOCH(State)			((State) >> (2 * LAYER_BITS))
+	// Upper "goal" size : the next Layer is allocated above it.
+	#define GROW_SIZE(LayerIdx)		uInt(Primes[(LayerIdx)] * Engine::MaxLoadFactor)
+	// Lower "goal" size : the top Layer is released below it.
+	#define SHRINK_SIZE(LayerIdx)	((LayerIdx) ? uInt(GROW_SIZE((LayerIdx) - 1) * SHRINK_LOAD_FACTOR) : uInt(0))
+	// Same, except that the Layers allocated by the constructor are not released.
+	#define SHRINK_GOAL(LayerIdx)	((LayerIdx) > MinLayerIdx ? SHRINK_SIZE(LayerIdx) : uInt(0))
 	// Defines a lambda function which is used by the ThreadManager to resize the table when needed.
-	#define RESIZE_FUNC				[=](uInt GlobalValue) -> uInt {						\
-										if (GlobalValue > Primes[LayerLastIdx]) {		\
-											AllocateLayer();							\
+	// The callback runs while holding the ManagerLock, possibly from a thread holding a Slot Lock : it only requests
+	// the resize, which is started by the next call to MigrateSlots(), so the Layer is allocated without holding any Lock.
+	#define RESIZE_FUNC				[=](uInt GlobalValue) -> std::pair<uInt, uInt> {	\
+										auto LayerLastIdx = LAST_IDX(LayerState.load(std::memory_order_acquire)); \
+										if (GlobalValue > GROW_SIZE(LayerLastIdx) || GlobalValue < SHRINK_GOAL(LayerLastIdx)) { \
+											ResizeRequested.store(true, std::memory_order_relaxed); \
 										}												\
-										return Primes[LayerLastIdx];					\
+										return std::make_pair(SHRINK_GOAL(LayerLastIdx), GROW_SIZE(LayerLastIdx)); \
 									}
 	// Resize the Slot container within a single macro.
-	#define MAP_ALLOC(Idx, Size)	{  Slots[Idx].resize(Size);	 }
-	// Dest is updated with Src.back(), and the last element of Src is deleted.		
-	#define SWAP_AND_POP(Dest, Src) {  Dest = std::move(Src.back());					\
-									   Src.pop_back(); }
+	#define MAP_ALLOC(Idx, Size)	{  Slots[Idx].resize(Size);	\
+									   Fingerprints[Idx].resize(Engine::FingerprintCount(Size)); }
 	// Initialize the class' fields within a single macro.
-	#define MAP_INIT()				{  Managers[InstanceIdx].SetCallback(RESIZE_FUNC);	\
+	#define MAP_INIT()				{  Manager.SetCallback(RESIZE_FUNC);	\
 									   auto FirstPrime = Primes[0U];					\
 									   MAP_ALLOC(0U, FirstPrime); }
+private:
+	// RAII class registering a walk over the Slots, so the KeyValues stay in their Slot meanwhile (see BeginWalk()).
+	struct Walker {
+		LayeredHashMap* pMap;
+		Walker(LayeredHashMap* _pMap) : pMap(_pMap) {
+			if (pMap) {
+				pMap->BeginWalk();
+			}
+		}
+		Walker(const Walker& Other) : Walker(Other.pMap) {}
+		Walker& operator= (const Walker& Other) {
+			Walker Copy(Other);
+			std::swap(pMap, Copy.pMap);
+			return *this;
+		}
+		~Walker() {
+			if (pMap) {
+				pMap->EndWalk();
+			}
+		}
+	};
+public:
+	/*! \class SafeIterator
+	* \brief Forward iterator over the KeyValues of the LayeredHashMap, giving a weakly consistent view while other threads keep on writing.
+	*
+	*  The KeyValues of a Slot are copied while it is read-locked, then iterated without holding any Lock.
+	*  Each KeyValue stored during the whole iteration is visited exactly once, the KeyValues written or deleted meanwhile may or may not be.
+	*  No migration is started while a SafeIterator exists (other than the end iterator) : AllocateLayer() and ReleaseLayer() wait for it.
+	*/
+	class SafeIterator {
+		friend class LayeredHashMap;
+		Walker Registration;
+		size_t NextRawHash; // Raw hash of the next Slot to be copied
+		size_t RawHashCount; // Number of Slots, which does not change during the iteration
+		Vector<std::pair<K, T> > KeyVals; // KeyValues of the current Slot
+		size_t KeyValIdx; // Index of the current KeyValue
+		SafeIterator(LayeredHashMap* pMap) : Registration(pMap), NextRawHash(0U), KeyValIdx(0U) {
+			RawHashCount = Primes[LAST_IDX(pMap->LayerState.load(std::memory_order_acquire))];
+			Fill();
+		}
+		/*!
+		*  \brief Copies the KeyValues of the next non-empty Slot, if any.
+		*/
+		void Fill() {
+			KeyVals.clear();
+			KeyValIdx = 0U;
+			while (KeyVals.empty() && NextRawHash < RawHashCount) {
+				auto CurHome = Registration.pMap->LocateHome(NextRawHash++, 0U);
+				ReadWrapper Lock(CurHome.HomeSlot().Lock);
+				CurHome.pLockValue = &Lock();
+				Engine::ForEach(CurHome, [&](Pair const& KeyVal) {
+					KeyVals.push_back(KeyVal);
+				});
+			}
+		}
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef std::pair<K, T> value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const std::pair<K, T>* pointer;
+		typedef const std::pair<K, T>& reference;
+		SafeIterator() : Registration(nullptr), NextRawHash(0U), RawHashCount(0U), KeyValIdx(0U) {}
+		inline reference operator* () const {
+			return KeyVals[KeyValIdx];
+		}
+		inline pointer operator-> () const {
+			return &KeyVals[KeyValIdx];
+		}
+		inline SafeIterator& operator++ () {
+			if (++KeyValIdx == KeyVals.size()) {
+				Fill();
+			}
+			return *this;
+		}
+		inline SafeIterator operator++ (int) {
+			auto Previous = *this;
+			++*this;
+			return Previous;
+		}
+		inline bool operator== (SafeIterator const& Other) const {
+			// All the end iterators are equal, whatever their LayeredHashMap.
+			if (KeyVals.empty() || Other.KeyVals.empty()) {
+				return KeyVals.empty() && Other.KeyVals.empty();
+			}
+			return Registration.pMap == Other.Registration.pMap && NextRawHash == Other.NextRawHash && KeyValIdx == Other.KeyValIdx;
+		}
+		inline bool operator!= (SafeIterator const& Other) const {
+			return !(*this == Other);
+		}
+	};
 private:
 	/*!
-	*  \brief Computes the raw hash of a Key.
+	*  \brief Computes the raw hash of a Key, given its hash and the last used Vector index passed as argument.
 	*/
-	inline size_t RawHash(K const&) const;
+	inline size_t RawHash(size_t const, size_t const) const;
 	/*!
 	*  \brief Computes the Layer index of a Key, given its raw hash passed as argument.
 	*/
@@ -153,22 +306,159 @@ private:
 	*  \brief Computes the Slot index (in the Layer) of a Key, given its raw hash and its Layer index, passed as argument.
 	*/
 	inline size_t GetSlot(size_t const, size_t const) const;
+	/*!
+	*  \brief Retrieves the Slot whose raw hash is passed as argument, along with its Layer, for the Key whose hash is passed as argument.
+	*
+	*  The returned Home has no Lock value yet : it is set once the Slot is locked.
+	*/
+	inline Home LocateHome(size_t const, size_t const);
+	/*!
+	*  \brief Locks the home Slot of the Key passed as argument, and calls Func(Home).
+	*
+	*  While a migration is pending, the Key stays in the Slot given by the previous last used Vector index
+	*  until this Slot is migrated: the previous Slot is then checked first.
+	*  Wrapper is either ReadWrapper or WriteWrapper.
+	*  If Func(Home) sets the KeyValue of the SlotAccessor passed as argument, the Slot is left locked and held by the SlotAccessor.
+	*/
+	template <class Wrapper, class Fn>
+	inline void ProcessSlot(K const&, Fn&&, SlotAccessor<Wrapper>* pAccessor = nullptr);
+	/*!
+	*  \brief Same as ProcessSlot(), given the hash of the Key passed as argument.
+	*/
+	template <class Wrapper, class Fn>
+	inline void ProcessHashedSlot(size_t const, Fn&&, SlotAccessor<Wrapper>* pAccessor = nullptr);
+	/*!
+	*  \brief Read the Value whose Key is the one passed as argument without locking its Slot.
+	*
+	*  The KeyValues are compared and copied by Engine::FindOptimistic() between AtomicRWLock::read_begin() and AtomicRWLock::read_validate(),
+	*  so the read does not write to shared memory.
+	*  This method fails if the Slot was written meanwhile, if a migration is pending, or if the Engine cannot complete the read without the Lock.
+	*
+	*  \return OPTIMISTIC_FOUND if the Key is found, and its Value copied to the Value pointed to unless the pointer is null,
+	*  OPTIMISTIC_NOT_FOUND if the Key is not found, OPTIMISTIC_FAILED if the Slot has to be locked to complete the read.
+	*/
+	inline OptimisticReadStatus OptimisticRead(K const&, size_t const, T*);
+	/*!
+	*  \brief Same as TryRead(), given the hash of the Key passed as argument : the Value is not copied if the pointer passed as argument is null.
+	*/
+	inline bool TryReadHashed(K const&, size_t const, T*);
+	/*!
+	*  \brief Moves the elements of the Slot whose raw hash is passed as argument to their new Slot, given the Layer state passed as argument.
+	*/
+	void MigrateSlot(size_t const, size_t const);
+	/*!
+	*  \brief Migrates at most the number of Slots passed as argument, if a migration is pending.
+	*
+	*  Only one thread migrates at a given time: if another thread is already migrating, this method returns immediatly,
+	*  leaving its Slots to the migrating thread, so the migration keeps up with the operations of all the threads.
+	*  If the second argument is true, it rather waits for the migrating thread, so the operations are slowed down to the migration pace.
+	*  This method must then not be called while holding a Slot Lock.
+	*/
+	void MigrateSlots(size_t const, bool const Wait = false);
+	/*!
+	*  \brief Try to start a migration, allocating a new Layer if the argument is true, releasing the top Layer otherwise.
+	*
+	*  This method does not wait : it fails if a migration is pending or if another thread is migrating.
+	*  If a Layer state is passed as second argument, no migration is started unless the Layer state still equals it.
+	*
+	*  \return false if the migration could not be started yet, true otherwise (including when there is no Layer to allocate or release).
+	*/
+	bool TryStartMigration(bool const, size_t const FromState = ~size_t(0));
+	/*!
+	*  \brief Start the migration growing or shrinking the LayeredHashMap, if its size is out of the "goal" sizes of its last Layer.
+	*
+	*  This method allocates the new Layer, so it must not be called while holding a Slot Lock, nor from the ThreadManager callback.
+	*/
+	void TryResize();
+	/*!
+	*  \brief Register a walk over the Slots, and complete the pending migration if any.
+	*
+	*  No migration is started until the walk ends, so the Layer state does not change meanwhile and the KeyValues stay in their Slot.
+	*  This method must then not be called while holding a Slot Lock.
+	*/
+	void BeginWalk();
+	/*!
+	*  \brief Unregister a walk over the Slots.
+	*/
+	void EndWalk();
+	/*!
+	*  \brief Copies the KeyValues of the locked home Slot to the snapshot in progress, if any, unless they have already been copied.
+	*
+	*  The home Slot must be write-locked.
+	*/
+	inline void PreserveSlot(Home const&);
+	/*!
+	*  \brief Write the Key and Value passed as argument, forwarding them so they are only copied or moved once into the Slot.
+	*/
+	template <class KeyArg, class ValueArg>
+	void ForwardWrite(KeyArg&&, ValueArg&&);
+	/*!
+	*  \brief Insert the Key passed as argument along with a Value constructed in place from the tuple of arguments, if the Key is not found.
+	*/
+	template <class KeyArg, class ValueArgs>
+	bool ForwardTryEmplace(KeyArg&&, ValueArgs&&);
+	/*!
+	*  \brief Write the KeyValues passed as argument (first KeyValue and count) into the unpublished LayeredHashMap, using the number of threads passed as argument.
+	*
+	*  The KeyValues are hashed and partitioned by ranges of raw hashes in parallel, then each thread fills the Slots of a range,
+	*  so no Slot Lock is ever contended. No migration may be pending.
+	*/
+	template <class RandomIt>
+	void BulkLoad(RandomIt, size_t const, size_t);
+	/*!
+	*  \brief Calls Func(ThreadIdx) from the number of threads passed as argument (at least one), the calling thread being the first one, and waits for them.
+	*/
+	static void RunThreads(size_t const, std::function<void(size_t)> const&);
+	/*!
+	*  \brief Calls Func(KeyValue) for each KeyValue of the Slots whose raw hashes are in [First, Last[, read-locking them one at a time.
+	*
+	*  A walk must be registered meanwhile.
+	*/
+	template <class Fn>
+	void WalkSlots(size_t const, size_t const, Fn&&);
 public:
 	/*!
 	*  \brief Allocate a new Layer in the LayeredHashMap.
 	*
-	*  This method allocates a new Layer, and moves the currently stored elements to their new position.
+	*  This method allocates a new Layer, and starts moving the currently stored elements to their new position.
+	*  The elements are then moved incrementally, MIGRATION_STEP Slots at a time, by each call to Write, Read or Delete.
+	*  If a migration is still pending, it is completed first: this method must then not be called while holding a Slot Lock.
 	*/
 	void AllocateLayer();
+	/*!
+	*  \brief Release the top Layer of the LayeredHashMap.
+	*
+	*  This method starts moving the currently stored elements to their position within the remaining Layers.
+	*  The elements are then moved incrementally, like in AllocateLayer(), and the top Layer is freed once the migration is over.
+	*  If a migration is still pending, it is completed first: this method must then not be called while holding a Slot Lock.
+	*/
+	void ReleaseLayer();
 public:
 	/*!
 	*  \brief Returns the LayeredHashMap size.
 	*
-	*  This method uses a ThreadManager to synchronize the sizes stored within each thread of execution.
+	*  This method uses a ThreadManager to sum the sizes stored within each thread of execution, without delaying the other threads.
+	*  Every Write or Delete which happened before the call is counted, the ones running meanwhile may or may not be.
 	*
 	*  \return The number of elements stored into the HashMap.
 	*/
 	inline size_t GetSize();
+	/*!
+	*  \brief Returns the LayeredHashMap size computed by the last update of the ThreadManager, in constant time.
+	*
+	*  The actual size stays between SHRINK_GOAL and GROW_SIZE of the Layers used at that update, up to a small margin (see ThreadManager::ApproximateGlobalValue()).
+	*  This method is suited to frequent polling, as it reads no size of a thread of execution, unlike GetSize().
+	*
+	*  \return The approximate number of elements stored into the HashMap.
+	*/
+	inline size_t ApproximateSize() const;
+	/*!
+	*  \brief Sets how the sizes stored within each thread of execution are modified, see ThreadManager::SetSingleWriter().
+	*
+	*  By default, each thread modifies its size by a relaxed load and store, as no other thread modifies it.
+	*  \param SingleWriter false to modify the sizes by an atomic read-modify-write instead.
+	*/
+	inline void SetSingleWriterCounters(bool const SingleWriter);
 	/*!
 	*  \brief Write the Key and Value passed as argument inside the LayeredHashMap.
 	*
@@ -180,6 +470,51 @@ public:
 	*
 	*/
 	void Write(K const& Key, T const& Val);
+	void Write(K const& Key, T&& Val);
+	void Write(K&& Key, T const& Val);
+	void Write(K&& Key, T&& Val);
+	/*!
+	*  \brief Insert the KeyValue constructed from the arguments if its Key is not found in the LayeredHashMap.
+	*
+	*  The arguments are the ones of a std::pair<K, T> : a Key and a Value, a std::pair, or std::piecewise_construct and two tuples.
+	*  As the Key has to be known to find its Slot, it is constructed first, unless it is passed as a K, and then moved into the Slot.
+	*  The Value is only constructed if the Key is not found, in place within the Slot.
+	*
+	*  \return true if the KeyValue has been inserted, false if the Key was already stored (its Value is then left untouched).
+	*/
+	template <class KeyArg, class ValueArg>
+	bool Emplace(KeyArg&& Key, ValueArg&& Val);
+	template <class KeyArg, class ValueArg>
+	bool Emplace(std::pair<KeyArg, ValueArg> const& KeyVal);
+	template <class KeyArg, class ValueArg>
+	bool Emplace(std::pair<KeyArg, ValueArg>&& KeyVal);
+	template <class... KeyArgs, class... ValueArgs>
+	bool Emplace(std::piecewise_construct_t, std::tuple<KeyArgs...> KeyArgTuple, std::tuple<ValueArgs...> ValueArgTuple);
+	/*!
+	*  \brief Write the KeyValues passed as argument inside the LayeredHashMap, locking each home Slot once for all its KeyValues.
+	*
+	*  The KeyValues are grouped by home Slot first : the KeyValues sharing a Key are written in their order, so the last Value is kept.
+	*  The size is updated once for the whole batch.
+	*  While a migration is pending, the KeyValues are rather written one at a time, as their home Slots may differ.
+	*  \param pKeyVals The KeyValues to be inserted.
+	*
+	*  \param Count The number of KeyValues.
+	*/
+	void MultiWrite(std::pair<K, T> const* pKeyVals, size_t const Count);
+	/*!
+	*  \brief Insert the Key passed as argument along with a Value constructed in place from the arguments, if the Key is not found.
+	*
+	*  The Value is only constructed if the Key is not found, and the Key is only copied or moved in this case.
+	*  \param Key The Key to be inserted.
+	*
+	*  \param args The arguments the Value is constructed from.
+	*
+	*  \return true if the KeyValue has been inserted, false if the Key was already stored (its Value is then left untouched).
+	*/
+	template <class... Args>
+	bool TryEmplace(K const& Key, Args&&... args);
+	template <class... Args>
+	bool TryEmplace(K&& Key, Args&&... args);
 	/*!
 	*  \brief Delete the Key passed as argument from the LayeredHashMap.
 	*
@@ -195,17 +530,158 @@ public:
 	*  \brief Read the Value whose Key is the one passed as argument.
 	*
 	*  This method throws std::out_of_range if the Key passed as argument is not found in the LayeredHashMap.
+	*  For trivially-copyable Keys and Values, an optimistic read is tried first, so the Slot is only locked on failure.
 	*  \param Key The Key which corresponding Value has to be found.
 	*
 	*  \return The Value whose Key is the one passed as argument.
 	*/
 	T Read(K const& Key); 
 	/*!
+	*  \brief Read the Value whose Key is the one passed as argument, without throwing if it is not found.
+	*
+	*  Like Read(), an optimistic read is tried first for trivially-copyable Keys and Values.
+	*  \param Key The Key which corresponding Value has to be found.
+	*
+	*  \param Value The Value whose Key is the one passed as argument, left untouched if the Key is not found.
+	*
+	*  \return true if the Key has been found, false otherwise.
+	*/
+	bool TryRead(K const& Key, T& Value);
+	/*!
+	*  \brief Check whether the Key passed as argument is stored in the LayeredHashMap, without copying its Value.
+	*
+	*  Like TryRead(), an optimistic read is tried first for trivially-copyable Keys and Values.
+	*  \param Key The Key to be found.
+	*
+	*  \return true if the Key has been found, false otherwise.
+	*/
+	bool Contains(K const& Key);
+	/*!
+	*  \brief Read the Values whose Keys are the ones passed as argument, a group of MULTI_READ_GROUP Keys at a time.
+	*
+	*  The Keys of a group are all hashed and their home Slots prefetched first, so the cache misses overlap,
+	*  before being read one after the other as with TryRead().
+	*  \param pKeys The Keys which corresponding Values have to be found.
+	*
+	*  \param Count The number of Keys.
+	*
+	*  \param pValues The Values whose Keys are the ones passed as argument, left untouched for the Keys not found.
+	*
+	*  \param pFound Whether each Key has been found or not.
+	*
+	*  \return The number of Keys found.
+	*/
+	size_t MultiRead(K const* pKeys, size_t const Count, T* pValues, bool* pFound);
+	/*!
+	*  \brief Call Func(Key, Value) for each KeyValue of the LayeredHashMap, while other threads keep on writing.
+	*
+	*  The Slots are read-locked one at a time while Func is called on their KeyValues : Func must not use the LayeredHashMap.
+	*  Each KeyValue stored during the whole walk is visited exactly once, the KeyValues written or deleted meanwhile may or may not be.
+	*  No migration is started during the walk.
+	*/
+	template <class Fn>
+	void ForEach(Fn&& Func);
+	/*!
+	*  \brief Call Func(Key, Value) for each KeyValue of the LayeredHashMap from the number of threads passed as argument, while other threads keep on writing.
+	*
+	*  The Slots are split into chunks of PARALLEL_WALK_CHUNK Slots, which the threads take one after the other until none is left,
+	*  so the threads finish at about the same time whatever the Layer sizes. Func is called concurrently, and must not use the LayeredHashMap.
+	*  The consistency is the same as ForEach().
+	*/
+	template <class Fn>
+	void ParallelForEach(Fn&& Func, size_t const ThreadCount = std::thread::hardware_concurrency());
+	/*!
+	*  \brief Reduce the KeyValues of the LayeredHashMap from the number of threads passed as argument, while other threads keep on writing.
+	*
+	*  Each thread computes Reduce(Result, Map(Key, Value)) over the KeyValues of the chunks it takes, starting from Init, then the partial results are reduced.
+	*  Init must then be the identity of Reduce (0 for a sum), and Reduce must be associative and commutative.
+	*  The Slots are split and walked as with ParallelForEach().
+	*
+	*  \return The reduced Value.
+	*/
+	template <class R, class MapFn, class ReduceFn>
+	R ParallelReduce(R const& Init, MapFn&& Map, ReduceFn&& Reduce, size_t const ThreadCount = std::thread::hardware_concurrency());
+	/*!
+	*  \brief Copy the KeyValues of the LayeredHashMap as they are when the snapshot starts, while other threads keep on writing.
+	*
+	*  The Slots are copied one at a time, by copy-on-write : the first thread writing to a Slot not copied yet copies it first, before modifying it.
+	*  The snapshot is consistent : it holds exactly the KeyValues stored at a single point in time, between the call and its return.
+	*  However, the Values modified through an Accessor acquired before this point in time are copied as they are when it is released.
+	*  No migration is started meanwhile, and a single snapshot is taken at a given time.
+	*
+	*  \return The KeyValues of the snapshot, in no particular order.
+	*/
+	std::vector<std::pair<K, T> > Snapshot();
+	/*!
+	*  \brief Returns a SafeIterator to the first KeyValue of the LayeredHashMap, and the end SafeIterator.
+	*/
+	SafeIterator begin() {
+		return SafeIterator(this);
+	}
+	SafeIterator end() {
+		return SafeIterator();
+	}
+	/*!
+	*  \brief Find the Key passed as argument, and hold its KeyValue with the SlotAccessor passed as argument.
+	*
+	*  The ConstAccessor read-locks the Slot, so the Value is read without being copied.
+	*  The Accessor write-locks the Slot, so the Value can be modified in place.
+	*  The KeyValue previously held by the SlotAccessor, if any, is released first.
+	*  \param Key The Key to be found.
+	*
+	*  \param Acc The SlotAccessor holding the KeyValue if it is found, empty otherwise.
+	*
+	*  \return true if the Key has been found, false otherwise.
+	*/
+	bool Find(K const& Key, ConstAccessor& Acc);
+	bool Find(K const& Key, Accessor& Acc);
+	/*!
+	*  \brief Update the Value whose Key is the one passed as argument, or insert it if the Key is not found, within a single lock of its Slot.
+	*
+	*  \param Key The Key to be updated or inserted.
+	*
+	*  \param Func The function called as Func(T&) on the stored Value if the Key is found.
+	*
+	*  \param args The arguments the Value is constructed from if the Key is not found.
+	*
+	*  \return true if the Key has been inserted, false if its Value has been updated.
+	*/
+	template <class Fn, class... Args>
+	bool Upsert(K const& Key, Fn&& Func, Args&&... args);
+	/*!
+	*  \brief Read the Value whose Key is the one passed as argument, or insert the Value returned by Factory() if the Key is not found,
+	*  within a single lock of its Slot.
+	*
+	*  Factory() is only called if the Key is not found.
+	*  \param Key The Key to be found or inserted.
+	*
+	*  \param Factory The function returning the Value to be inserted.
+	*
+	*  \return The stored Value, whether it has just been inserted or not.
+	*/
+	template <class Fn>
+	T ComputeIfAbsent(K const& Key, Fn&& Factory);
+	/*!
+	*  \brief Combine the Value passed as argument into the Value whose Key is the one passed as argument, within a single lock of its Slot.
+	*
+	*  If the Key is found, its Value is replaced by Combiner(StoredValue, Value). Otherwise, the Key is inserted along with Value.
+	*  \param Key The Key to be merged.
+	*
+	*  \param Value The Value to be merged.
+	*
+	*  \param Combiner The function returning the merged Value.
+	*
+	*  \return true if the Key has been inserted, false if its Value has been merged.
+	*/
+	template <class Fn>
+	bool Merge(K const& Key, T const& Value, Fn&& Combiner);
+	/*!
 	*  \brief LayeredHashMap constructor.
 	*
 	*  This method allocates the first Layer.
 	*/
-	LayeredHashMap() : LayerLastIdx(0U), InstanceIdx(AvailableInstanceIdx.pop_front()) {
+	LayeredHashMap() : LayerState(LAYER_STATE(0U, 0U, 0U)), MigrationCursor(0U), MigrationCredit(0U), WalkerCount(0U), ResizeRequested(false), MinLayerIdx(0U) {
+		LastSnapshot.Epoch = 0U;
 		MAP_INIT();
 	}
 	/*!*
@@ -213,48 +689,225 @@ public:
 	*
 	*  \param InitialSize The desired initial size.
 	*
-	*  This method allocates Layers, so the initial size of the LayeredHashMap is greater or equal to InitialSize.
+	*  This method allocates Layers, so the initial capacity of the LayeredHashMap is greater or equal to InitialSize.
+	*  As the LayeredHashMap is still empty, no migration is needed. These Layers are only released by ReleaseLayer(), not as the size decreases.
 	*/
-	LayeredHashMap(const size_t InitialSize) : LayerLastIdx(0U), InstanceIdx(AvailableInstanceIdx.pop_front()) {
+	LayeredHashMap(const size_t InitialSize) : LayerState(LAYER_STATE(0U, 0U, 0U)), MigrationCursor(0U), MigrationCredit(0U), WalkerCount(0U), ResizeRequested(false), MinLayerIdx(0U) {
+		LastSnapshot.Epoch = 0U;
 		MAP_INIT();
-		while (Primes[LayerLastIdx] < InitialSize) {
-			AllocateLayer();
+		size_t LayerLastIdx = 0U;
+		while (GROW_SIZE(LayerLastIdx) < InitialSize && LayerLastIdx + 1 < MaxLayerCount) {
+			++LayerLastIdx;
+			MAP_ALLOC(LayerLastIdx, Primes[LayerLastIdx] - Primes[LayerLastIdx - 1]);
 		}
+		MinLayerIdx = LayerLastIdx;
+		LayerState.store(LAYER_STATE(LayerLastIdx, LayerLastIdx, 0U), std::memory_order_release);
 	}
-	/*!
-	*  \brief LayeredHashMap destructor.
+	/*!*
+	*  \brief LayeredHashMap constructor from a range of KeyValues.
+	*
+	*  \param First, Last The random-access range of KeyValues to be inserted : for KeyValues sharing a Key, the last one is kept.
+	*
+	*  \param ThreadCount The number of threads loading the KeyValues.
 	*
-	*  This method appends the instance index into the available instance index list, so it can be reused afterwards.
+	*  This method allocates Layers as the constructor with initial size hint does, then loads the KeyValues in parallel.
 	*/
-	~LayeredHashMap() {
-		Managers[InstanceIdx].Reset();
-		AvailableInstanceIdx.push_front(InstanceIdx);
+	template <class RandomIt>
+	LayeredHashMap(RandomIt First, RandomIt Last, size_t const ThreadCount = std::thread::hardware_concurrency()) : LayeredHashMap(size_t(Last - First)) {
+		BulkLoad(First, size_t(Last - First), ThreadCount);
 	}
 };
 
-template <class K, class T, class Hash, class Pred, class Alloc>
-void LayeredHashMap<K, T, Hash, Pred, Alloc>::AllocateLayer() {
-	// Allocate a new Vector in the Hashtable.
-	auto OldPrime = Primes[LayerLastIdx++];
-	auto NewPrime = Primes[LayerLastIdx];
-	auto DeltaPrime = NewPrime - OldPrime;
-	MAP_ALLOC(LayerLastIdx, DeltaPrime);
-	// Move elements
-	/* To do ... */
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+void LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::AllocateLayer() {
+	// Complete the pending migration first, so the elements are all hashed with LAST_IDX.
+	while (!TryStartMigration(true)) {
+		MigrateSlots(Primes[MIGRATION_IDX(LayerState.load(std::memory_order_acquire))]);
+		std::this_thread::yield();
+	}
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+void LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::ReleaseLayer() {
+	// Complete the pending migration first, so the elements are all hashed with LAST_IDX.
+	while (!TryStartMigration(false)) {
+		MigrateSlots(Primes[MIGRATION_IDX(LayerState.load(std::memory_order_acquire))]);
+		std::this_thread::yield();
+	}
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+bool LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::TryStartMigration(bool const Grow, size_t const FromState) {
+	// The MigrationLock is held so the top Layer is not freed meanwhile by the end of a previous release.
+	if (!MigrationLock.try_lock()) {
+		return false;
+	}
+	// No migration is started during a walk over the Slots : BeginWalk() acquires the MigrationLock after registering the walk.
+	if (WalkerCount.load(std::memory_order_seq_cst)) {
+		MigrationLock.unlock();
+		return false;
+	}
+	auto State = LayerState.load(std::memory_order_acquire);
+	auto LayerLastIdx = LAST_IDX(State);
+	auto IsIdle = (MIGRATION_IDX(State) == LAST_IDX(State));
+	// The migration is not started either if another one has started meanwhile.
+	auto CanStart = IsIdle && (FromState == ~size_t(0) || FromState == State);
+	if (CanStart && Grow && LayerLastIdx + 1 < MaxLayerCount) {
+		// Allocate a new Vector in the Hashtable.
+		// Other threads keep on using the previous Layers meanwhile, as the new one is not published yet.
+		auto OldPrime = Primes[LayerLastIdx];
+		auto NewPrime = Primes[LayerLastIdx + 1];
+		auto DeltaPrime = NewPrime - OldPrime;
+		MAP_ALLOC(LayerLastIdx + 1, DeltaPrime);
+		// Start a new migration : the Slots [0, OldPrime[ are now to be migrated.
+		// The new Layer, the new epoch and the cursor are published at once by the release store.
+		MigrationCursor = 0U;
+		MigrationCredit.store(0U, std::memory_order_relaxed);
+		LayerState.store(LAYER_STATE(LayerLastIdx + 1, LayerLastIdx, EPOCH(State) + 1), std::memory_order_release);
+	}
+	else if (CanStart && !Grow && LayerLastIdx > 0U) {
+		// Start a new migration : the Slots [0, Primes[LayerLastIdx][ are now to be migrated to the remaining Layers.
+		MigrationCursor = 0U;
+		MigrationCredit.store(0U, std::memory_order_relaxed);
+		LayerState.store(LAYER_STATE(LayerLastIdx - 1, LayerLastIdx, EPOCH(State) + 1), std::memory_order_release);
+	}
+	MigrationLock.unlock();
+	return IsIdle;
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+void LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::TryResize() {
+	// The size is compared to the "goal" sizes of this Layer state : no migration is started if it changes meanwhile.
+	auto State = LayerState.load(std::memory_order_acquire);
+	auto GlobalValue = Manager.GetGlobalValue();
+	if (GlobalValue > GROW_SIZE(LAST_IDX(State))) {
+		TryStartMigration(true, State);
+	}
+	else if (GlobalValue < SHRINK_GOAL(LAST_IDX(State))) {
+		TryStartMigration(false, State);
+	}
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+void LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::BeginWalk() {
+	WalkerCount.fetch_add(1, std::memory_order_seq_cst);
+	// A migration may have been started before the walk was registered : wait for it to be published.
+	MigrationLock.lock();
+	MigrationLock.unlock();
+	// Then complete it, so the KeyValues are all hashed with LAST_IDX.
+	do {
+		auto State = LayerState.load(std::memory_order_acquire);
+		if (MIGRATION_IDX(State) == LAST_IDX(State)) {
+			return;
+		}
+		MigrateSlots(Primes[MIGRATION_IDX(State)]);
+		std::this_thread::yield();
+	} while (true);
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+void LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::EndWalk() {
+	WalkerCount.fetch_sub(1, std::memory_order_release);
+	// A resize may have been refused during the walk : check the size again.
+	ResizeRequested.store(true, std::memory_order_relaxed);
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+void LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::MigrateSlot(size_t const rawHash, size_t const State) {
+	auto LayerLastIdx = LAST_IDX(State);
+	auto SrcHome = LocateHome(rawHash, 0U);
+	WriteWrapper SrcLock(SrcHome.HomeSlot().Lock);
+	SrcHome.pLockValue = &SrcLock();
+	// Move the KeyValues which now belong to another Slot to this Slot.
+	// The Keys are not hashed again, as their hash is stored along with them.
+	Engine::ExtractIf(SrcHome, [&](Pair& KeyVal, size_t const KeyHash) -> bool {
+		auto DstRawHash = RawHash(KeyHash, LayerLastIdx);
+		if (DstRawHash == rawHash) {
+			return false;
+		}
+		auto DstHome = LocateHome(DstRawHash, KeyHash);
+		WriteWrapper DstLock(DstHome.HomeSlot().Lock);
+		DstHome.pLockValue = &DstLock();
+		Engine::Emplace(DstHome, std::move(KeyVal));
+		return true;
+	});
+	// From now on, the Keys hashed to this Slot with MIGRATION_IDX are looked for in their new Slot.
+	SrcHome.HomeSlot().Epoch = EPOCH(State);
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+void LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::MigrateSlots(size_t const Count, bool const Wait) {
+	// Don't wait for the migrating thread, but rather return.
+	auto State = LayerState.load(std::memory_order_acquire);
+	if (MIGRATION_IDX(State) == LAST_IDX(State)) {
+		// Start the resize requested by the ThreadManager, if any.
+		if (ResizeRequested.load(std::memory_order_relaxed) && ResizeRequested.exchange(false, std::memory_order_relaxed)) {
+			TryResize();
+		}
+		return;
+	}
+	if (Wait) {
+		MigrationLock.lock();
+	}
+	else if (!MigrationLock.try_lock()) {
+		MigrationCredit.fetch_add(Count, std::memory_order_relaxed);
+		return;
+	}
+	// The migration might have been completed while acquiring the Lock.
+	auto IsOver = false;
+	State = LayerState.load(std::memory_order_acquire);
+	if (MIGRATION_IDX(State) != LAST_IDX(State)) {
+		auto SrcPrime = Primes[MIGRATION_IDX(State)];
+		auto LastCursor = std::min(SrcPrime, MigrationCursor + Count + MigrationCredit.exchange(0U, std::memory_order_relaxed));
+		for (; MigrationCursor < LastCursor; ++MigrationCursor) {
+			MigrateSlot(MigrationCursor, State);
+		}
+		// Every Slot has been migrated : the migration is over.
+		if (MigrationCursor == SrcPrime) {
+			IsOver = true;
+			LayerState.store(LAYER_STATE(LAST_IDX(State), LAST_IDX(State), EPOCH(State)), std::memory_order_seq_cst);
+			// The top Layer has been released : wait for the threads that may still use its Slots, and free it.
+			// The threads marked after the store load the new state, so they do not locate the Slots of the released Layer.
+			if (MIGRATION_IDX(State) > LAST_IDX(State)) {
+				Manager.WaitForOptimisticReads();
+				Vector<Slot>().swap(Slots[MIGRATION_IDX(State)]);
+				Vector<AtomicFingerprint>().swap(Fingerprints[MIGRATION_IDX(State)]);
+			}
+		}
+	}
+	MigrationLock.unlock();
+	// The "goal" sizes have changed : compute the thresholds of the ThreadValues again, and start the next migration
+	// if the size is already out of them, as no ThreadValue may cross its threshold anymore (eg. once the deletions stop).
+	if (IsOver) {
+		Manager.ForceUpdateManager();
+		if (ResizeRequested.load(std::memory_order_relaxed) && ResizeRequested.exchange(false, std::memory_order_relaxed)) {
+			TryResize();
+		}
+	}
 }
 
-template <class K, class T, class Hash, class Pred, class Alloc>
-inline size_t LayeredHashMap<K, T, Hash, Pred, Alloc>::GetSize() {
-	return Managers[InstanceIdx].GetGlobalValue();
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+inline size_t LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::GetSize() {
+	return Manager.GetGlobalValue();
 }
 
-template <class K, class T, class Hash, class Pred, class Alloc>
-inline size_t LayeredHashMap<K, T, Hash, Pred, Alloc>::RawHash(K const& Key) const {
-	return (Hash()(Key) & NextPower[LayerLastIdx]) % Primes[LayerLastIdx];
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+inline size_t LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::ApproximateSize() const {
+	return Manager.ApproximateGlobalValue();
 }
 
-template <class K, class T, class Hash, class Pred, class Alloc>
-inline size_t LayeredHashMap<K, T, Hash, Pred, Alloc>::GetLayer(size_t const rawHash) const {
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+inline void LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::SetSingleWriterCounters(bool const SingleWriter) {
+	Manager.SetSingleWriter(SingleWriter);
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+inline size_t LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::RawHash(size_t const KeyHash, size_t const LayerIdx) const {
+	return MaskedModPrime(KeyHash, LayerIdx);
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+inline size_t LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::GetLayer(size_t const rawHash) const {
 	// If rawHash is < LowestNextPower, we add LowestNextPower to it and compute the Log2.
 	// But Log2(Sum) < Log2(2*LowestNextPower) so Log2(Sum) = Log2(LowestNextPower) = LowestExponent.
 	// So LayerIdx = 0U in this case.
@@ -264,117 +917,571 @@ inline size_t LayeredHashMap<K, T, Hash, Pred, Alloc>::GetLayer(size_t const raw
 	return LayerIdx + (rawHash >= Primes[LayerIdx]);
 }
 
-template <class K, class T, class Hash, class Pred, class Alloc>
-inline size_t LayeredHashMap<K, T, Hash, Pred, Alloc>::GetSlot(size_t const rawHash, size_t const LayerIdx) const {
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+inline size_t LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::GetSlot(size_t const rawHash, size_t const LayerIdx) const {
 	return rawHash - Primes[LayerIdx - 1];
 }
 
-template <class K, class T, class Hash, class Pred, class Alloc>
-void LayeredHashMap<K, T, Hash, Pred, Alloc>::Write(K const& Key, T const& Value) {
-	auto rawHash = RawHash(Key);
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+inline typename LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::Home LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::LocateHome(size_t const rawHash, size_t const KeyHash) {
 	auto LayerIdx = GetLayer(rawHash);
 	auto SlotIdx = GetSlot(rawHash, LayerIdx);
-	auto& MainPair = Slots[LayerIdx][SlotIdx].Main;
-	WriteWrapper WriteLock(Slots[LayerIdx][SlotIdx].Lock);
-	// If the slot is empty, simply write the new KeyVal in the Main KeyVal, and increment the Size.
-	if (WriteLock() == EMPTY) {
-		MainPair = std::move(Pair(Key, Value));
-		Values[InstanceIdx].Increment();
-	}
-	// If the Main Key is already correct, simply replace the Value.
-	else if (Pred()(MainPair.first, Key)) {
-		MainPair.second = Value;
-	}
-	// Check for Collisions.
-	else {
-		auto CollisionIt = std::move(std::find_if(Slots[LayerIdx][SlotIdx].Collisions.begin(), 
-												  Slots[LayerIdx][SlotIdx].Collisions.end(), 
-												  [&](Pair const& _KeyVal) -> bool {
-			return Pred()(_KeyVal.first, Key);
-		}));
-		// If a collision is not found, append the new KeyVal at the end of the collisions vector and increment the Size.
-		if (CollisionIt == Slots[LayerIdx][SlotIdx].Collisions.end()) {
-			Slots[LayerIdx][SlotIdx].Collisions.emplace_back(Key, Value);
-			Values[InstanceIdx].Increment();
-		}
-		// Otherwise, update the value of the current collided Value.
-		else {
-			(*CollisionIt).second = Value;
+	return Home{ Slots[LayerIdx].data(), Slots[LayerIdx].size(), SlotIdx, nullptr, &Shared, Fingerprints[LayerIdx].data(), KeyHash };
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+template <class Wrapper, class Fn>
+inline void LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::ProcessSlot(K const& Key, Fn&& Func, SlotAccessor<Wrapper>* pAccessor) {
+	ProcessHashedSlot<Wrapper>(Hash()(Key), std::forward<Fn>(Func), pAccessor);
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+template <class Wrapper, class Fn>
+inline void LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::ProcessHashedSlot(size_t const KeyHash, Fn&& Func, SlotAccessor<Wrapper>* pAccessor) {
+	// Take part in the pending migration, if any : wait for it if the Slots are overloaded meanwhile.
+	MigrateSlots(MIGRATION_STEP, Engine::IsOverloaded(Shared, Primes[LAST_IDX(LayerState.load(std::memory_order_relaxed))]));
+	auto& ThrValue = Manager.LocalValue();
+	do {
+		// Mark the thread before loading the Layer state, so a Layer released meanwhile is not freed before the Slot is locked.
+		// Once the Slot is locked and the state is unchanged, the Slot cannot be migrated, so its Layer is not freed until it is unlocked.
+		// The User is destroyed after the Locks, so a retry unlocks the Slots first.
+		LayerUser User(ThrValue);
+		auto State = LayerState.load(std::memory_order_acquire);
+		// If the Slot given by the previous last used Vector index is not migrated yet, the Key can only be there.
+		if (MIGRATION_IDX(State) != LAST_IDX(State)) {
+			auto SrcHome = LocateHome(RawHash(KeyHash, MIGRATION_IDX(State)), KeyHash);
+			Wrapper SrcLock(SrcHome.HomeSlot().Lock);
+			// The Layer state has changed before the Slot was locked : the Slot might have been migrated, so try again.
+			if (LayerState.load(std::memory_order_acquire) != State) {
+				continue;
+			}
+			if (SrcHome.HomeSlot().Epoch != EPOCH(State)) {
+				User.Release();
+				SrcHome.pLockValue = &SrcLock();
+				if (std::is_same<Wrapper, WriteWrapper>::value) {
+					PreserveSlot(SrcHome);
+				}
+				Func(SrcHome);
+				if (pAccessor && pAccessor->pKeyVal) {
+					pAccessor->Lock = std::move(SrcLock);
+				}
+				return;
+			}
+		}
+		auto DstHome = LocateHome(RawHash(KeyHash, LAST_IDX(State)), KeyHash);
+		Wrapper DstLock(DstHome.HomeSlot().Lock);
+		// Same as above : once the Slot is locked, no migration can move its elements until it is unlocked.
+		if (LayerState.load(std::memory_order_acquire) != State) {
+			continue;
+		}
+		User.Release();
+		DstHome.pLockValue = &DstLock();
+		// Before modifying the Slot, copy it to the snapshot in progress, if any.
+		if (std::is_same<Wrapper, WriteWrapper>::value) {
+			PreserveSlot(DstHome);
+		}
+		Func(DstHome);
+		if (pAccessor && pAccessor->pKeyVal) {
+			pAccessor->Lock = std::move(DstLock);
+		}
+		return;
+	} while (true);
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+inline OptimisticReadStatus LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::OptimisticRead(K const& Key, size_t const KeyHash, T* pValue) {
+	// The Key may be in one of two Slots while migrating : lock them.
+	auto State = LayerState.load(std::memory_order_acquire);
+	if (MIGRATION_IDX(State) != LAST_IDX(State)) {
+		return OPTIMISTIC_FAILED;
+	}
+	auto& ThrValue = Manager.LocalValue();
+	auto Status = OPTIMISTIC_FAILED;
+	// Mark the read, so the Layer is not freed while reading it. The Layer state is then checked again, 
+	// as a Layer could have been released before the mark.
+	ThrValue.BeginOptimisticRead();
+	if (LayerState.load(std::memory_order_acquire) == State) {
+		auto CurHome = LocateHome(RawHash(KeyHash, LAST_IDX(State)), KeyHash);
+		auto LockState = CurHome.HomeSlot().Lock.read_begin();
+		Status = Engine::FindOptimistic(CurHome, LockState, Key, pValue);
+		// Discard the result if the Slot has been written meanwhile.
+		if (!CurHome.HomeSlot().Lock.read_validate(LockState)) {
+			Status = OPTIMISTIC_FAILED;
 		}
 	}
-	WriteLock() = POPULATED;
+	ThrValue.EndOptimisticRead();
+	return Status;
 }
 
-template <class K, class T, class Hash, class Pred, class Alloc>
-bool LayeredHashMap<K, T, Hash, Pred, Alloc>::Delete(K const& Key) {
-	auto rawHash = RawHash(Key);
-	auto LayerIdx = GetLayer(rawHash);
-	auto SlotIdx = GetSlot(rawHash, LayerIdx);
-	auto deletionOccured = true;
-	WriteWrapper WriteLock(Slots[LayerIdx][SlotIdx].Lock);
-	auto NewSlotStatus = WriteLock();
-	// Empty slot : nothing to delete.
-	if (NewSlotStatus == EMPTY) {
-		deletionOccured = false; 
-	} 
-	// The key is found in the Main value:
-	else if (Pred()(Slots[LayerIdx][SlotIdx].Main.first, Key)) {
-		// Take the last collision and make it the new Main value, so the current Main value is erased.
-		if (!Slots[LayerIdx][SlotIdx].Collisions.empty()) {
-			SWAP_AND_POP(Slots[LayerIdx][SlotIdx].Main, Slots[LayerIdx][SlotIdx].Collisions);
-		}
-		// If there are no collisions, the slot is empty.
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+template <class KeyArg, class ValueArg>
+void LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::ForwardWrite(KeyArg&& Key, ValueArg&& Value) {
+	ProcessSlot<WriteWrapper>(Key, [&](Home const& CurHome) {
+		auto pKeyVal = Engine::Find(CurHome, Key);
+		// If the Key is already stored, simply replace the Value.
+		if (pKeyVal) {
+			pKeyVal->second = std::forward<ValueArg>(Value);
+		}
+		// Otherwise, insert the new KeyVal and increment the Size.
 		else {
-			NewSlotStatus = EMPTY;
+			Engine::Emplace(CurHome, std::forward<KeyArg>(Key), std::forward<ValueArg>(Value));
+			Manager.LocalValue().Increment();
+		}
+	});
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+void LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::Write(K const& Key, T const& Value) {
+	ForwardWrite(Key, Value);
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+void LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::Write(K const& Key, T&& Value) {
+	ForwardWrite(Key, std::move(Value));
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+void LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::Write(K&& Key, T const& Value) {
+	ForwardWrite(std::move(Key), Value);
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+void LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::Write(K&& Key, T&& Value) {
+	ForwardWrite(std::move(Key), std::move(Value));
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+template <class RandomIt>
+void LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::BulkLoad(RandomIt First, size_t const Count, size_t ThreadCount) {
+	ThreadCount = std::max(size_t(1), ThreadCount);
+	auto LayerLastIdx = LAST_IDX(LayerState.load(std::memory_order_acquire));
+	// The KeyValues are read by chunks of the input, and written by ranges of raw hashes.
+	auto ChunkBegin = [&](size_t const ChunkIdx) -> size_t {
+		return Count / ThreadCount * ChunkIdx + std::min(ChunkIdx, Count % ThreadCount);
+	};
+	auto RangeSize = Primes[LayerLastIdx] / ThreadCount + 1;
+	auto RangeIdx = [&](size_t const KeyHash) -> size_t {
+		return RawHash(KeyHash, LayerLastIdx) / RangeSize;
+	};
+	Vector<size_t> KeyHashes(Count), Order(Count), Offsets(ThreadCount * ThreadCount, 0U), InsertedCounts(ThreadCount, 0U);
+	// Hash the KeyValues, and count the KeyValues of each chunk per range.
+	RunThreads(ThreadCount, [&](size_t const ChunkIdx) {
+		for (auto Idx = ChunkBegin(ChunkIdx); Idx < ChunkBegin(ChunkIdx + 1); ++Idx) {
+			KeyHashes[Idx] = Hash()(First[Idx].first);
+			++Offsets[ChunkIdx * ThreadCount + RangeIdx(KeyHashes[Idx])];
+		}
+	});
+	// Lay the ranges out one after the other, each chunk after the previous ones within a range, so the input order is kept.
+	Vector<size_t> RangeBegin(ThreadCount + 1);
+	size_t Offset = 0U;
+	for (size_t Range = 0U; Range < ThreadCount; ++Range) {
+		RangeBegin[Range] = Offset;
+		for (size_t ChunkIdx = 0U; ChunkIdx < ThreadCount; ++ChunkIdx) {
+			auto ChunkCount = Offsets[ChunkIdx * ThreadCount + Range];
+			Offsets[ChunkIdx * ThreadCount + Range] = Offset;
+			Offset += ChunkCount;
 		}
 	}
-	// Traverse the Collision vector.
-	else {
-		auto CollisionIt = std::move(std::find_if(Slots[LayerIdx][SlotIdx].Collisions.begin(), 
-												  Slots[LayerIdx][SlotIdx].Collisions.end(), 
-												  [&](Pair const& _KeyVal) -> bool {
-			return Pred()(_KeyVal.first, Key);
-		}));
-		// Take the last collision and move it to the found value (which will be deleted).
-		if (CollisionIt != Slots[LayerIdx][SlotIdx].Collisions.end()) {
-			SWAP_AND_POP(*CollisionIt, Slots[LayerIdx][SlotIdx].Collisions);
+	RangeBegin[ThreadCount] = Offset;
+	RunThreads(ThreadCount, [&](size_t const ChunkIdx) {
+		for (auto Idx = ChunkBegin(ChunkIdx); Idx < ChunkBegin(ChunkIdx + 1); ++Idx) {
+			Order[Offsets[ChunkIdx * ThreadCount + RangeIdx(KeyHashes[Idx])]++] = Idx;
 		}
-		// Key not found : return false.
-		else {
-			deletionOccured = false;
+	});
+	// Fill the Slots of each range : the Locks are only taken to keep the Slot state consistent, no other thread uses them.
+	RunThreads(ThreadCount, [&](size_t const Range) {
+		for (auto OrderIdx = RangeBegin[Range]; OrderIdx < RangeBegin[Range + 1]; ++OrderIdx) {
+			auto Idx = Order[OrderIdx];
+			auto CurHome = LocateHome(RawHash(KeyHashes[Idx], LayerLastIdx), KeyHashes[Idx]);
+			WriteWrapper Lock(CurHome.HomeSlot().Lock);
+			CurHome.pLockValue = &Lock();
+			auto pKeyVal = Engine::Find(CurHome, First[Idx].first);
+			if (pKeyVal) {
+				pKeyVal->second = First[Idx].second;
+			}
+			else {
+				Engine::Emplace(CurHome, First[Idx].first, First[Idx].second);
+				++InsertedCounts[Range];
+			}
 		}
+	});
+	size_t InsertedCount = 0U;
+	for (auto RangeCount : InsertedCounts) {
+		InsertedCount += RangeCount;
+	}
+	Manager.LocalValue().Add(_sInt(InsertedCount));
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+void LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::MultiWrite(std::pair<K, T> const* pKeyVals, size_t const Count) {
+	Vector<size_t> KeyHashes(Count), RawHashes(Count), Order(Count);
+	for (size_t Idx = 0U; Idx < Count; ++Idx) {
+		KeyHashes[Idx] = Hash()(pKeyVals[Idx].first);
+		Order[Idx] = Idx;
 	}
-	// Decrement the size if a deletion occured.
-	if (deletionOccured) {
-		Values[InstanceIdx].Decrement();
+	// Sort the remaining KeyValues by raw hash, given the Layer state, so the KeyValues sharing a home Slot are consecutive.
+	auto State = LayerState.load(std::memory_order_acquire);
+	auto GroupBySlot = [&](size_t const FirstIdx) {
+		for (auto OrderIt = Order.begin() + FirstIdx; OrderIt != Order.end(); ++OrderIt) {
+			RawHashes[*OrderIt] = RawHash(KeyHashes[*OrderIt], LAST_IDX(State));
+		}
+		std::stable_sort(Order.begin() + FirstIdx, Order.end(), [&](size_t const A, size_t const B) -> bool {
+			return RawHashes[A] < RawHashes[B];
+		});
+	};
+	GroupBySlot(0U);
+	_sInt InsertedCount = 0;
+	for (size_t OrderIdx = 0U; OrderIdx < Count;) {
+		auto FirstIdx = Order[OrderIdx];
+		auto RunEnd = OrderIdx + 1;
+		while (RunEnd < Count && RawHashes[Order[RunEnd]] == RawHashes[FirstIdx]) {
+			++RunEnd;
+		}
+		ProcessHashedSlot<WriteWrapper>(KeyHashes[FirstIdx], [&](Home const& CurHome) {
+			// If the Layer state is unchanged and no migration is pending, the locked Slot is the home Slot of the whole run.
+			// Otherwise, only the first KeyValue is written.
+			if (LayerState.load(std::memory_order_acquire) != State || MIGRATION_IDX(State) != LAST_IDX(State)) {
+				RunEnd = OrderIdx + 1;
+			}
+			for (; OrderIdx < RunEnd; ++OrderIdx) {
+				auto& KeyVal = pKeyVals[Order[OrderIdx]];
+				auto RunHome = CurHome;
+				RunHome.KeyHash = KeyHashes[Order[OrderIdx]];
+				auto pKeyVal = Engine::Find(RunHome, KeyVal.first);
+				if (pKeyVal) {
+					pKeyVal->second = KeyVal.second;
+				}
+				else {
+					Engine::Emplace(RunHome, KeyVal.first, KeyVal.second);
+					++InsertedCount;
+				}
+			}
+		});
+		// Group the remaining KeyValues again if the Layer state has changed meanwhile.
+		auto NewState = LayerState.load(std::memory_order_acquire);
+		if (NewState != State && OrderIdx < Count) {
+			State = NewState;
+			GroupBySlot(OrderIdx);
+		}
 	}
-	WriteLock() = NewSlotStatus;
+	Manager.LocalValue().Add(InsertedCount);
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+template <class KeyArg, class ValueArgs>
+bool LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::ForwardTryEmplace(KeyArg&& Key, ValueArgs&& ValueArgTuple) {
+	auto insertionOccured = false;
+	ProcessSlot<WriteWrapper>(Key, [&](Home const& CurHome) {
+		// Construct the new KeyVal in the Slot and increment the Size, only if the Key is not stored yet.
+		if (!Engine::Find(CurHome, Key)) {
+			Engine::Emplace(CurHome, std::piecewise_construct, std::forward_as_tuple(std::forward<KeyArg>(Key)), std::forward<ValueArgs>(ValueArgTuple));
+			Manager.LocalValue().Increment();
+			insertionOccured = true;
+		}
+	});
+	return insertionOccured;
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+template <class KeyArg, class ValueArg>
+bool LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::Emplace(KeyArg&& Key, ValueArg&& Val) {
+	// A Key passed as a K is only referred to, otherwise the Key is constructed here.
+	typedef typename std::conditional<std::is_same<typename std::decay<KeyArg>::type, K>::value, KeyArg&&, K>::type StoredKey;
+	StoredKey CurKey(std::forward<KeyArg>(Key));
+	return ForwardTryEmplace(std::forward<StoredKey>(CurKey), std::forward_as_tuple(std::forward<ValueArg>(Val)));
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+template <class KeyArg, class ValueArg>
+bool LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::Emplace(std::pair<KeyArg, ValueArg> const& KeyVal) {
+	return Emplace(KeyVal.first, KeyVal.second);
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+template <class KeyArg, class ValueArg>
+bool LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::Emplace(std::pair<KeyArg, ValueArg>&& KeyVal) {
+	return Emplace(std::forward<KeyArg>(KeyVal.first), std::forward<ValueArg>(KeyVal.second));
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+template <class... KeyArgs, class... ValueArgs>
+bool LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::Emplace(std::piecewise_construct_t, std::tuple<KeyArgs...> KeyArgTuple, std::tuple<ValueArgs...> ValueArgTuple) {
+	// The Key is constructed from its tuple through a std::pair, as std::pair<K, T> would.
+	std::pair<K, char> KeyHolder(std::piecewise_construct, std::move(KeyArgTuple), std::tuple<>());
+	return ForwardTryEmplace(std::move(KeyHolder.first), std::move(ValueArgTuple));
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+template <class... Args>
+bool LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::TryEmplace(K const& Key, Args&&... args) {
+	return ForwardTryEmplace(Key, std::forward_as_tuple(std::forward<Args>(args)...));
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+template <class... Args>
+bool LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::TryEmplace(K&& Key, Args&&... args) {
+	return ForwardTryEmplace(std::move(Key), std::forward_as_tuple(std::forward<Args>(args)...));
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+template <class Fn, class... Args>
+bool LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::Upsert(K const& Key, Fn&& Func, Args&&... args) {
+	auto insertionOccured = false;
+	ProcessSlot<WriteWrapper>(Key, [&](Home const& CurHome) {
+		auto pKeyVal = Engine::Find(CurHome, Key);
+		// If the Key is already stored, update its Value in place.
+		if (pKeyVal) {
+			Func(pKeyVal->second);
+		}
+		// Otherwise, construct the new KeyVal and increment the Size.
+		else {
+			Engine::Emplace(CurHome, std::piecewise_construct, std::forward_as_tuple(Key), std::forward_as_tuple(std::forward<Args>(args)...));
+			Manager.LocalValue().Increment();
+			insertionOccured = true;
+		}
+	});
+	return insertionOccured;
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+template <class Fn>
+T LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::ComputeIfAbsent(K const& Key, Fn&& Factory) {
+	T Value;
+	ProcessSlot<WriteWrapper>(Key, [&](Home const& CurHome) {
+		auto pKeyVal = Engine::Find(CurHome, Key);
+		// Only compute the Value if the Key is not stored yet.
+		if (!pKeyVal) {
+			pKeyVal = Engine::Emplace(CurHome, Key, Factory());
+			Manager.LocalValue().Increment();
+		}
+		Value = pKeyVal->second;
+	});
+	return Value;
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+template <class Fn>
+bool LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::Merge(K const& Key, T const& Value, Fn&& Combiner) {
+	return Upsert(Key, [&](T& StoredValue) {
+		StoredValue = Combiner(StoredValue, Value);
+	}, Value);
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+bool LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::Delete(K const& Key) {
+	auto deletionOccured = false;
+	ProcessSlot<WriteWrapper>(Key, [&](Home const& CurHome) {
+		auto pKeyVal = Engine::Find(CurHome, Key);
+		// Erase the KeyVal and decrement the Size if it is found.
+		if (pKeyVal) {
+			Engine::Erase(CurHome, pKeyVal);
+			Manager.LocalValue().Decrement();
+			deletionOccured = true;
+		}
+	});
 	return deletionOccured;
 }
 
-template <class K, class T, class Hash, class Pred, class Alloc>
-T LayeredHashMap<K, T, Hash, Pred, Alloc>::Read(K const& Key) {
-	auto rawHash = RawHash(Key);
-	auto LayerIdx = GetLayer(rawHash);
-	auto SlotIdx = GetSlot(rawHash, LayerIdx);
-	ReadWrapper ReadLock(Slots[LayerIdx][SlotIdx].Lock);
-	// Empty slot : throw an exception.
-	if (ReadLock() == EMPTY) {
-		throw std::out_of_range("The key was not found in the LayeredHashMap structure: The Slot was not populated.");
-	}
-	// Look in the main value for equal keys.
-	if (Pred()(Slots[LayerIdx][SlotIdx].Main.first, Key)) {
-		return Slots[LayerIdx][SlotIdx].Main.second;
-	}
-	// Look in the collision vector for equal keys.
-	auto CollisionIt = std::move(std::find_if(Slots[LayerIdx][SlotIdx].Collisions.begin(),
-											  Slots[LayerIdx][SlotIdx].Collisions.end(), 
-											  [&](Pair const& _KeyVal) -> bool {
-		return Pred()(_KeyVal.first, Key);
-	}));
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+T LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::Read(K const& Key) {
+	T Value;
 	// If it is not found, throw an exception.
-	if (CollisionIt == Slots[LayerIdx][SlotIdx].Collisions.end()) {
+	if (!TryRead(Key, Value)) {
 		throw std::out_of_range("The key was not found in the LayeredHashMap structure: The Key was not found in the Slot.");
 	}
-	return CollisionIt->second;
+	return Value;
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+bool LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::TryRead(K const& Key, T& Value) {
+	return TryReadHashed(Key, Hash()(Key), &Value);
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+inline bool LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::TryReadHashed(K const& Key, size_t const KeyHash, T* pValue) {
+	if (OptimisticReads) {
+		// The optimistic reads take part in the pending migration as well, so a read-mostly workload still completes it.
+		MigrateSlots(MIGRATION_STEP);
+		auto Status = OptimisticRead(Key, KeyHash, pValue);
+		if (Status != OPTIMISTIC_FAILED) {
+			return Status == OPTIMISTIC_FOUND;
+		}
+	}
+	auto isFound = false;
+	ProcessHashedSlot<ReadWrapper>(KeyHash, [&](Home const& CurHome) {
+		auto pKeyVal = Engine::Find(CurHome, Key);
+		if (pKeyVal) {
+			if (pValue) {
+				*pValue = pKeyVal->second;
+			}
+			isFound = true;
+		}
+	});
+	return isFound;
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+size_t LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::MultiRead(K const* pKeys, size_t const Count, T* pValues, bool* pFound) {
+	size_t KeyHashes[MULTI_READ_GROUP];
+	size_t FoundCount = 0U;
+	auto& ThrValue = Manager.LocalValue();
+	for (size_t GroupIdx = 0U; GroupIdx < Count; GroupIdx += MULTI_READ_GROUP) {
+		auto GroupCount = std::min(size_t(MULTI_READ_GROUP), Count - GroupIdx);
+		for (size_t Idx = 0U; Idx < GroupCount; ++Idx) {
+			KeyHashes[Idx] = Hash()(pKeys[GroupIdx + Idx]);
+		}
+		// Prefetch the home Slots of the group, in every Layer the Keys may be in.
+		// Like an optimistic read, the Layers are not freed meanwhile.
+		auto State = LayerState.load(std::memory_order_acquire);
+		ThrValue.BeginOptimisticRead();
+		if (LayerState.load(std::memory_order_acquire) == State) {
+			for (size_t Idx = 0U; Idx < GroupCount; ++Idx) {
+				Engine::Prefetch(LocateHome(RawHash(KeyHashes[Idx], LAST_IDX(State)), KeyHashes[Idx]));
+				if (MIGRATION_IDX(State) != LAST_IDX(State)) {
+					Engine::Prefetch(LocateHome(RawHash(KeyHashes[Idx], MIGRATION_IDX(State)), KeyHashes[Idx]));
+				}
+			}
+		}
+		ThrValue.EndOptimisticRead();
+		// Then read the Keys of the group, whose home Slots should be cached by now.
+		for (size_t Idx = 0U; Idx < GroupCount; ++Idx) {
+			pFound[GroupIdx + Idx] = TryReadHashed(pKeys[GroupIdx + Idx], KeyHashes[Idx], &pValues[GroupIdx + Idx]);
+			FoundCount += pFound[GroupIdx + Idx];
+		}
+	}
+	return FoundCount;
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+template <class Fn>
+void LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::ForEach(Fn&& Func) {
+	Walker Registration(this);
+	WalkSlots(0U, Primes[LAST_IDX(LayerState.load(std::memory_order_acquire))], [&](Pair const& KeyVal) {
+		Func(KeyVal.first, KeyVal.second);
+	});
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+template <class Fn>
+void LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::ParallelForEach(Fn&& Func, size_t const ThreadCount) {
+	ParallelReduce(0, [&](K const& Key, T const& Value) -> int {
+		Func(Key, Value);
+		return 0;
+	}, [](int, int) -> int {
+		return 0;
+	}, ThreadCount);
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+template <class R, class MapFn, class ReduceFn>
+R LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::ParallelReduce(R const& Init, MapFn&& Map, ReduceFn&& Reduce, size_t const ThreadCount) {
+	Walker Registration(this);
+	auto RawHashCount = Primes[LAST_IDX(LayerState.load(std::memory_order_acquire))];
+	std::atomic<size_t> NextChunk(0U);
+	std::vector<R> Results(std::max(size_t(1), ThreadCount), Init);
+	RunThreads(ThreadCount, [&](size_t const ThreadIdx) {
+		auto& Result = Results[ThreadIdx];
+		// Take the next chunk until none is left.
+		for (auto First = NextChunk.fetch_add(PARALLEL_WALK_CHUNK, std::memory_order_relaxed); First < RawHashCount;
+			 First = NextChunk.fetch_add(PARALLEL_WALK_CHUNK, std::memory_order_relaxed)) {
+			WalkSlots(First, std::min(First + PARALLEL_WALK_CHUNK, RawHashCount), [&](Pair const& KeyVal) {
+				Result = Reduce(std::move(Result), Map(KeyVal.first, KeyVal.second));
+			});
+		}
+	});
+	auto Result = std::move(Results[0]);
+	for (size_t ThreadIdx = 1U; ThreadIdx < Results.size(); ++ThreadIdx) {
+		Result = Reduce(std::move(Result), std::move(Results[ThreadIdx]));
+	}
+	return Result;
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+std::vector<std::pair<K, T> > LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::Snapshot() {
+	std::lock_guard<AtomicLock> lock(SnapshotLock);
+	Walker Registration(this);
+	{
+		std::lock_guard<AtomicLock> KeyValsLock(LastSnapshot.Lock);
+		LastSnapshot.KeyVals.clear();
+	}
+	// From now on the Epoch is odd, and the writers copy the Slots they modify first : the snapshot is taken at this point in time.
+	LastSnapshot.Epoch.fetch_add(1U, std::memory_order_seq_cst);
+	auto RawHashCount = Primes[LAST_IDX(LayerState.load(std::memory_order_acquire))];
+	for (size_t rawHash = 0U; rawHash < RawHashCount; ++rawHash) {
+		auto CurHome = LocateHome(rawHash, 0U);
+		WriteWrapper Lock(CurHome.HomeSlot().Lock);
+		CurHome.pLockValue = &Lock();
+		PreserveSlot(CurHome);
+	}
+	// All the Slots are copied : a writer still reading the odd Epoch finds its Slot already copied.
+	LastSnapshot.Epoch.fetch_add(1U, std::memory_order_seq_cst);
+	std::lock_guard<AtomicLock> KeyValsLock(LastSnapshot.Lock);
+	return std::move(LastSnapshot.KeyVals);
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+inline void LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::PreserveSlot(Home const& CurHome) {
+	// The Slot is locked : the snapshot read here is either completed, and the Slot already copied, or waits for the Slot.
+	auto const Epoch = LastSnapshot.Epoch.load(std::memory_order_seq_cst);
+	if (!(Epoch & 1U)) {
+		return;
+	}
+	// Every Slot is marked by each snapshot, so a mark left by the snapshot before the previous one never remains : the parity is enough.
+	auto& Lock = CurHome.HomeSlot().Lock;
+	auto const Mark = uint_fast64_t(1U + ((Epoch >> 1) & 1U)) << SNAPSHOT_MARK_SHIFT;
+	auto Meta = Lock.meta();
+	if ((Meta & SNAPSHOT_MARK_MASK) == Mark) {
+		return;
+	}
+	while (!Lock.compare_exchange_meta(Meta, (Meta & ~SNAPSHOT_MARK_MASK) | Mark));
+	std::lock_guard<AtomicLock> KeyValsLock(LastSnapshot.Lock);
+	Engine::ForEach(CurHome, [&](Pair const& KeyVal) {
+		LastSnapshot.KeyVals.push_back(KeyVal);
+	});
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+void LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::RunThreads(size_t const ThreadCount, std::function<void(size_t)> const& Func) {
+	std::vector<std::thread> Threads;
+	for (size_t ThreadIdx = 1U; ThreadIdx < ThreadCount; ++ThreadIdx) {
+		Threads.emplace_back(Func, ThreadIdx);
+	}
+	Func(0U);
+	for (auto& Thr : Threads) {
+		Thr.join();
+	}
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+template <class Fn>
+void LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::WalkSlots(size_t const First, size_t const Last, Fn&& Func) {
+	for (auto rawHash = First; rawHash < Last; ++rawHash) {
+		auto CurHome = LocateHome(rawHash, 0U);
+		ReadWrapper Lock(CurHome.HomeSlot().Lock);
+		CurHome.pLockValue = &Lock();
+		Engine::ForEach(CurHome, Func);
+	}
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+bool LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::Contains(K const& Key) {
+	return TryReadHashed(Key, Hash()(Key), nullptr);
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+bool LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::Find(K const& Key, ConstAccessor& Acc) {
+	Acc.Release();
+	ProcessSlot<ReadWrapper>(Key, [&](Home const& CurHome) {
+		Acc.pKeyVal = Engine::Find(CurHome, Key);
+	}, &Acc);
+	return !Acc.Empty();
+}
+
+template <class K, class T, class Hash, class Pred, class Alloc, class Policy>
+bool LayeredHashMap<K, T, Hash, Pred, Alloc, Policy>::Find(K const& Key, Accessor& Acc) {
+	Acc.Release();
+	ProcessSlot<WriteWrapper>(Key, [&](Home const& CurHome) {
+		Acc.pKeyVal = Engine::Find(CurHome, Key);
+	}, &Acc);
+	return !Acc.Empty();
 }
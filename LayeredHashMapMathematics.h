@@ -24,17 +24,36 @@ Created by: Matthieu Pinard, Ecole des Mines de Saint-Etienne, matthieu.pinard@e
 * \author Matthieu Pinard
 */
 
-// The function returns the integer part of log2(X) by retrieving the position of the most significant set bit.
-// It uses bit twiddling hacks (as seen on graphics.stanford.edu) to favor speed.
-
-const unsigned long b32[] = { 0x2, 0xC, 0xF0, 0xFF00, 0xFFFF0000 };
-const unsigned long long b64[] = { 0x2, 0xC, 0xF0, 0xFF00, 0xFFFF0000, 0xFFFFFFFF00000000 };
+#include <cstddef>
+#include <cstdint>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
-const size_t * b = (sizeof(size_t) <= 4) ? (const size_t*)b32 : (const size_t*)b64;
-const size_t S[] = { 1, 2, 4, 8, 16, 32 };
+// The function returns the integer part of log2(X) by retrieving the position of the most significant set bit.
+// It uses the count leading zeros instruction when available, and bit twiddling hacks (as seen on graphics.stanford.edu) otherwise.
+// IntLog2(0) returns 0.
+
+#if SIZE_MAX > 0xFFFFFFFF
+constexpr size_t b[] = { 0x2, 0xC, 0xF0, 0xFF00, 0xFFFF0000, 0xFFFFFFFF00000000 };
+#else
+constexpr size_t b[] = { 0x2, 0xC, 0xF0, 0xFF00, 0xFFFF0000 };
+#endif
+constexpr size_t S[] = { 1, 2, 4, 8, 16, 32 };
 constexpr int Log2Iterations = (sizeof(size_t) <= 4) ? 4 : 5;
 
 inline size_t IntLog2(size_t X) {
+#if defined(__GNUC__) || defined(__clang__)
+	return (sizeof(unsigned long long) * 8 - 1) - __builtin_clzll(static_cast<unsigned long long>(X) | 1ULL);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+	unsigned long Result;
+	_BitScanReverse64(&Result, static_cast<unsigned long long>(X) | 1ULL);
+	return Result;
+#elif defined(_MSC_VER)
+	unsigned long Result;
+	_BitScanReverse(&Result, static_cast<unsigned long>(X) | 1UL);
+	return Result;
+#else
 	size_t Result = 0U;
 	for (auto i = Log2Iterations; i >= 0; i--) {
 		if (X & b[i]) {
@@ -43,6 +62,7 @@ inline size_t IntLog2(size_t X) {
 		}
 	}
 	return Result;
+#endif
 }
 
 // Arrays of prime numbers P (starting at Primes[0] or __Primes[1]) and powers of two (NP), satisfying some conditions.
@@ -52,16 +72,8 @@ inline size_t IntLog2(size_t X) {
 // P[i + 1] > P[i] + NP[i]
 // P[i] - NP[i] < P[0]
 
-const unsigned long __Primes_32b[] = {
-	0, 757, 1783, 3833, 7937,
-	16141, 32537, 65327, 130873,
-	261977, 524123, 1048433, 2097013,
-	4194167, 8388473, 16777121, 33554341,
-	67108777, 134217649, 268435399, 536870869,
-	1073741789, 2147483629, 4294967291
-};
-
-const unsigned long long __Primes_64b[] = {
+#if SIZE_MAX > 0xFFFFFFFF
+constexpr size_t __Primes[] = {
 	0, 2633, 6733, 14929, 31321, 64091, 
 	129643, 260723, 522883, 1047173, 2095759, 
 	4192919, 8387231, 16775849, 33553103, 67107569, 
@@ -73,16 +85,7 @@ const unsigned long long __Primes_64b[] = {
 	4503599627369863, 9007199254740397
 };
 
-const unsigned long NextPower_32b[] = {
-	(1U << 10) - 1, (1U << 11) - 1, (1U << 12) - 1, (1U << 13) - 1,
-	(1U << 14) - 1, (1U << 15) - 1, (1U << 16) - 1, (1U << 17) - 1,
-	(1U << 18) - 1, (1U << 19) - 1, (1U << 20) - 1, (1U << 21) - 1,
-	(1U << 22) - 1, (1U << 23) - 1, (1U << 24) - 1, (1U << 25) - 1,
-	(1U << 26) - 1, (1U << 27) - 1, (1U << 28) - 1, (1U << 29) - 1,
-	(1U << 30) - 1, (1U << 31) - 1, 4294967295
-};
-
-const unsigned long long NextPower_64b[] = {
+constexpr size_t __NextPower[] = {
 	(1ULL << 12) - 1, (1ULL << 13) - 1,
 	(1ULL << 14) - 1, (1ULL << 15) - 1, (1ULL << 16) - 1, (1ULL << 17) - 1,
 	(1ULL << 18) - 1, (1ULL << 19) - 1, (1ULL << 20) - 1, (1ULL << 21) - 1,
@@ -95,13 +98,32 @@ const unsigned long long NextPower_64b[] = {
 	(1ULL << 46) - 1, (1ULL << 47) - 1, (1ULL << 48) - 1, (1ULL << 49) - 1,
 	(1ULL << 50) - 1, (1ULL << 51) - 1, (1ULL << 52) - 1, (1ULL << 53) - 1
 };
+#else
+constexpr size_t __Primes[] = {
+	0, 757, 1783, 3833, 7937,
+	16141, 32537, 65327, 130873,
+	261977, 524123, 1048433, 2097013,
+	4194167, 8388473, 16777121, 33554341,
+	67108777, 134217649, 268435399, 536870869,
+	1073741789, 2147483629, 4294967291
+};
 
-const size_t * NextPower = (sizeof(size_t) <= 4) ? (const size_t*)NextPower_32b : (const size_t*)NextPower_64b;
+constexpr size_t __NextPower[] = {
+	(1U << 10) - 1, (1U << 11) - 1, (1U << 12) - 1, (1U << 13) - 1,
+	(1U << 14) - 1, (1U << 15) - 1, (1U << 16) - 1, (1U << 17) - 1,
+	(1U << 18) - 1, (1U << 19) - 1, (1U << 20) - 1, (1U << 21) - 1,
+	(1U << 22) - 1, (1U << 23) - 1, (1U << 24) - 1, (1U << 25) - 1,
+	(1U << 26) - 1, (1U << 27) - 1, (1U << 28) - 1, (1U << 29) - 1,
+	(1U << 30) - 1, (1U << 31) - 1, 4294967295
+};
+#endif
+
+constexpr const size_t * NextPower = __NextPower;
 
 // So that Primes[-1] == __Primes[0] = 0. 
 // This is done to improve performance as it prevents a conditional. 
 
-const size_t * Primes = (sizeof(size_t) <= 4) ? (const size_t*)&__Primes_32b[1] : (const size_t*)&__Primes_64b[1];
+constexpr const size_t * Primes = &__Primes[1];
 
 // Equals log2(NextPower[0] + 1) - 1
 
@@ -114,3 +136,11 @@ constexpr size_t MaxLayerCount = (sizeof(size_t) <= 4) ? 23 : 42;
 //Equals 2^LowestExponent
 
 constexpr size_t LowestNextPower = (sizeof(size_t) <= 4) ? 512 : 2048;
+
+// The function returns (X & NP[i]) % P[i] without any division.
+// As NP[i] = 2 * NP[i - 1] + 1 and NP[i - 1] < P[i], the masked value is below 2 * P[i] : a single conditional subtraction reduces it.
+
+inline size_t MaskedModPrime(size_t X, size_t LayerIdx) {
+	X &= NextPower[LayerIdx];
+	return X - (X >= Primes[LayerIdx]) * Primes[LayerIdx];
+}
@@ -47,12 +47,12 @@ inline unsigned int GenerateSeqInt() {
 	return ++Cnt;
 }
 
-template<class T>
+template<class T, class Policy = ChainingPolicy>
 double BenchLayeredHashMap(const size_t Iterations, const size_t ThreadCount, const std::vector<T>& Precomputed) {
 	std::vector<std::thread> Threads(ThreadCount);
 	LARGE_INTEGER Begin, End, Frequency;
 	QueryPerformanceCounter(&Begin);
-	LayeredHashMap<T, size_t> shm(Iterations);
+	LayeredHashMap<T, size_t, LayeredHash<T>, std::equal_to<T>, std::allocator<T>, Policy> shm(Iterations);
 	for (size_t i = 0U; i < ThreadCount; i++) {
 		Threads[i] = std::thread([=, &shm]() {
 			for (auto j = i; j < Iterations; j += ThreadCount) {
@@ -119,6 +119,35 @@ double BenchConcurrentUnorderedMap(const size_t Iterations, const size_t ThreadC
 	return (End.QuadPart - Begin.QuadPart) / (Frequency.QuadPart + 0.0);
 }
 
+// Bench the per-thread counters alone : each thread increments its ThreadValue, as every insertion does.
+double BenchThreadValues(const size_t Iterations, const size_t ThreadCount) {
+	std::vector<std::thread> Threads(ThreadCount);
+	ThreadManager Manager;
+	// Keep the "goal" global value out of reach, so the threads seldom update the ThreadManager.
+	Manager.SetCallback([=](uInt) -> std::pair<uInt, uInt> {
+		return std::make_pair(uInt(0), uInt(2 * Iterations * ThreadCount));
+	});
+	LARGE_INTEGER Begin, End, Frequency;
+	QueryPerformanceCounter(&Begin);
+	for (size_t i = 0U; i < ThreadCount; i++) {
+		Threads[i] = std::thread([=, &Manager]() {
+			auto& ThrValue = Manager.LocalValue();
+			for (size_t j = 0U; j < Iterations; j++) {
+				ThrValue.Increment();
+			}
+		});
+	}
+	for (auto i = 0U; i < ThreadCount; i++) {
+		Threads[i].join();
+	}
+	QueryPerformanceCounter(&End);
+	QueryPerformanceFrequency(&Frequency);
+	if (Manager.GetGlobalValue() != Iterations * ThreadCount) {
+		std::cout << "Count Error with " << ThreadCount << " threads\n";
+	}
+	return (End.QuadPart - Begin.QuadPart) / (Frequency.QuadPart + 0.0);
+}
+
 int main() {
 	// Type of Key to bench
 	using T = std::string;
@@ -134,11 +163,14 @@ int main() {
 	std::vector<T> Precomputed(ElementCount);
 	for (size_t i = 0; i < ElementCount; ++i)
 		Precomputed[i] = Func();
-	// Bench the 3 solutions.
-	double Layered = 0., Concurrent = 0., Tbb = 0.;
+	// Bench the 3 solutions, and both Slot Policies of the LayeredHashMap.
+	double Layered = 0., LayeredOpenAddressing = 0., Concurrent = 0., Tbb = 0.;
 	for (auto Try = 0; Try < NumberOfTries; Try++) {
 		Layered += BenchLayeredHashMap<T>(ElementCount, ThreadCount, Precomputed);
 	}
+	for (auto Try = 0; Try < NumberOfTries; Try++) {
+		LayeredOpenAddressing += BenchLayeredHashMap<T, OpenAddressingPolicy>(ElementCount, ThreadCount, Precomputed);
+	}
 	for (auto Try = 0; Try < NumberOfTries; Try++) {
 		Concurrent += BenchConcurrentUnorderedMap<T>(ElementCount, ThreadCount, Precomputed);
 	}
@@ -147,6 +179,7 @@ int main() {
 	}
 	// Precision of the result : 10^-2 s
 	Layered = ceil(Layered * 100.) / 100.;
+	LayeredOpenAddressing = ceil(LayeredOpenAddressing * 100.) / 100.;
 	Concurrent = ceil(Concurrent * 100.) / 100.;
 	Tbb = ceil(Tbb * 100.) / 100.;
 	// Display the results
@@ -154,8 +187,15 @@ int main() {
 			  << typeid(T).name() 
 			  << " \ninserted with " << ThreadCount << " threads\n";
 	std::cout << "LayeredHashMap:           " << Layered / NumberOfTries	<< " s\n";
+	std::cout << "LayeredHashMap (OA):      " << LayeredOpenAddressing / NumberOfTries << " s\n";
 	std::cout << "Microsoft Concurrency:    " << Concurrent / NumberOfTries << " s\n";
 	std::cout << "Intel TBB:                " << Tbb / NumberOfTries		<< " s\n";
+	// Bench the per-thread counters from 1 to 64 threads : with no false sharing, the throughput scales with the thread count.
+	auto CounterIterations = 10000000U;
+	for (size_t CounterThreads = 1U; CounterThreads <= 64U; CounterThreads *= 2U) {
+		auto Elapsed = BenchThreadValues(CounterIterations, CounterThreads);
+		std::cout << "ThreadValue, " << CounterThreads << " threads: " << CounterIterations * CounterThreads / Elapsed / 1e6 << " M increments/s\n";
+	}
 	(void)getchar();
 }
 
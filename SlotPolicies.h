@@ -0,0 +1,672 @@
+/*
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Created by: Matthieu Pinard, Ecole des Mines de Saint-Etienne, matthieu.pinard@etu.emse.fr
+15-05-2016: Initial release
+*/
+
+#pragma once
+
+/*!
+* \file SlotPolicies.h
+* \brief Layouts of the KeyValues within the Slots of a LayeredHashMap Layer.
+* \author Matthieu Pinard
+*
+*  A Slot Policy provides with an Engine class template, defining the Slot type and the operations on the KeyValues
+*  whose home is a given Slot. The LayeredHashMap locks the home Slot (and handles the Layers and the migrations),
+*  the Engine then finds, inserts and removes the KeyValues while the home Slot is locked.
+*/
+#include "AtomicRWLock.h"
+#include "InlineVector.h"
+#include "ThreadManager/AtomicLock.h"
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+#include <utility>
+#include <cstdint>
+#include <atomic>
+#include <new>
+
+// The fingerprints are compared a group at a time using AVX2 or SSE2 if available, unless FINGERPRINT_SCALAR is defined.
+// ThreadSanitizer cannot tell that the group loads only read hints (see LoadFingerprintGroup()) : they are compared one at a time under it.
+#if defined(__SANITIZE_THREAD__)
+#define FINGERPRINT_SCALAR
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define FINGERPRINT_SCALAR
+#endif
+#endif
+#if !defined(FINGERPRINT_SCALAR) && defined(__AVX2__)
+#include <immintrin.h>
+#define FINGERPRINT_AVX2
+#elif !defined(FINGERPRINT_SCALAR) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define FINGERPRINT_SSE2
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Number of collided KeyValues stored within a Slot, before spilling them to the heap (ChainingPolicy).
+#ifndef INLINE_COLLISION_COUNT
+#define INLINE_COLLISION_COUNT 2
+#endif
+
+// Maximum distance between a KeyValue and its home Slot, before stashing it (OpenAddressingPolicy).
+// The distance is stored within the DISTANCE_MASK bits, so PROBE_LENGTH cannot exceed 32.
+#ifndef PROBE_LENGTH
+#define PROBE_LENGTH 32
+#endif
+
+// Number of fingerprints compared at once : the PROBE_LENGTH fingerprints following a home Slot are loaded as a single group.
+#define FINGERPRINT_GROUP 32
+
+// Dest is updated with Src.back(), and the last element of Src is deleted.
+#define SWAP_AND_POP(Dest, Src) {  Dest = std::move(Src.back());					\
+								   Src.pop_back(); }
+
+// Hints the processor to fetch the cache line at Address, so the subsequent accesses do not stall on it.
+#ifdef _MSC_VER
+#define PREFETCH(Address) _mm_prefetch(reinterpret_cast<const char*>(Address), _MM_HINT_T0)
+#else
+#define PREFETCH(Address) __builtin_prefetch(Address)
+#endif
+
+// Result of an optimistic read.
+enum OptimisticReadStatus { OPTIMISTIC_FOUND, OPTIMISTIC_NOT_FOUND, OPTIMISTIC_FAILED };
+
+// Fingerprints of the EMPTY and TOMBSTONE Slots : the fingerprints of the OCCUPIED Slots have their high bit set.
+const uint8_t EMPTY_FINGERPRINT = 0x00, TOMBSTONE_FINGERPRINT = 0x01;
+
+/*! \struct AtomicFingerprint
+* \brief 1-byte fingerprint of a Slot, written by the thread holding the Lock of its home Slot while other threads read the neighbouring fingerprints.
+*
+*  The fingerprints are written by relaxed stores, and read by relaxed loads or a group at a time (see LoadFingerprintGroup()).
+*  Like AtomicRWLock, copying a fingerprint (when its Layer is allocated) does not need to be atomic.
+*/
+struct AtomicFingerprint : std::atomic<uint8_t> {
+	AtomicFingerprint() : std::atomic<uint8_t>(EMPTY_FINGERPRINT) {}
+	AtomicFingerprint(const AtomicFingerprint& Other) : std::atomic<uint8_t>(Other.load(std::memory_order_relaxed)) {}
+};
+static_assert(sizeof(AtomicFingerprint) == sizeof(uint8_t), "The fingerprints must be laid out as bytes, so a group of them is loaded at once.");
+
+/*! \struct SlotHome
+* \brief The locked home Slot of a Key, along with the Layer it belongs to.
+*/
+template <class Slot, class Shared>
+struct SlotHome {
+	Slot* pLayer; // First Slot of the Layer
+	size_t LayerSize; // Number of Slots in the Layer
+	size_t SlotIdx; // Index of the home Slot in the Layer
+	uint_fast64_t* pLockValue; // Value of the home Slot Lock, as held by its ReadWrapper or WriteWrapper
+	Shared* pShared; // Data shared by all the Slots of the LayeredHashMap
+	AtomicFingerprint* pFingerprints; // Fingerprints of the Layer Slots, if the Policy uses them
+	size_t KeyHash; // Hash of the Key looked for or inserted
+	inline Slot& HomeSlot() const {
+		return pLayer[SlotIdx];
+	}
+};
+
+/*!
+*  \brief Computes the 1-byte fingerprint of a Key from its hash, mixing the hash so the low bits used by RawHash are not the only ones relevant.
+*/
+inline uint8_t Fingerprint(size_t const KeyHash) {
+	return uint8_t(0x80 | ((KeyHash * size_t(0x9E3779B97F4A7C15ULL)) >> (sizeof(size_t) * 8 - 7)));
+}
+
+#if defined(FINGERPRINT_AVX2) || defined(FINGERPRINT_SSE2)
+/*!
+*  \brief Loads the fingerprints starting at pFirst at once : 32 of them with AVX2, 16 with SSE2.
+*
+*  This is the only read of the fingerprints which is not atomic, and it races with the relaxed stores of the threads holding the Lock
+*  of a neighbouring home Slot : a fingerprint it returns may then be stale, or even torn from the stored one.
+*  This is deliberate, as the fingerprints are only hints : the Entry state of each candidate is checked afterwards, and the fingerprints
+*  of the KeyValues of a locked home Slot are not written meanwhile (an optimistic read validates its result instead).
+*/
+#if defined(FINGERPRINT_AVX2)
+inline __m256i LoadFingerprintGroup(const AtomicFingerprint* pFirst) {
+	return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pFirst));
+}
+#else
+inline __m128i LoadFingerprintGroup(const AtomicFingerprint* pFirst) {
+	return _mm_loadu_si128(reinterpret_cast<const __m128i*>(pFirst));
+}
+#endif
+#endif
+
+/*!
+*  \brief Returns the mask of the fingerprints equal to the one passed as argument, among the PROBE_LENGTH fingerprints starting at pGroup.
+*
+*  FINGERPRINT_GROUP fingerprints are readable from pGroup, whatever PROBE_LENGTH.
+*/
+inline uint32_t MatchFingerprints(const AtomicFingerprint* pGroup, uint8_t const Fp) {
+#if defined(FINGERPRINT_AVX2)
+	auto Mask = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(LoadFingerprintGroup(pGroup), _mm256_set1_epi8(char(Fp)))));
+#elif defined(FINGERPRINT_SSE2)
+	auto Needle = _mm_set1_epi8(char(Fp));
+	auto LowMask = uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(LoadFingerprintGroup(pGroup), Needle)));
+	auto HighMask = uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(LoadFingerprintGroup(pGroup + 16), Needle)));
+	auto Mask = LowMask | (HighMask << 16);
+#else
+	uint32_t Mask = 0U;
+	for (size_t Idx = 0U; Idx < PROBE_LENGTH; ++Idx) {
+		Mask |= uint32_t(pGroup[Idx].load(std::memory_order_relaxed) == Fp) << Idx;
+	}
+#endif
+	return PROBE_LENGTH < 32 ? Mask & ((uint32_t(1) << (PROBE_LENGTH % 32)) - 1) : Mask;
+}
+
+/*!
+*  \brief Returns the index of the lowest bit set in the non-zero mask passed as argument.
+*/
+inline size_t LowestBitIdx(uint32_t const Mask) {
+#ifdef _MSC_VER
+	unsigned long Idx;
+	_BitScanForward(&Idx, Mask);
+	return Idx;
+#else
+	return __builtin_ctz(Mask);
+#endif
+}
+
+/*! \struct HashedPair
+* \brief KeyValue stored along with the hash of its Key.
+*
+*  The hashes are compared before the Keys, so Pred() is only called on equal hashes, and the Keys are not hashed again while migrating.
+*/
+template <class K, class T>
+struct HashedPair : std::pair<K, T> {
+	size_t KeyHash; // Hash of the Key
+	HashedPair() : KeyHash(0U) {}
+	template <class... Args>
+	HashedPair(size_t const _KeyHash, Args&&... args) : std::pair<K, T>(std::forward<Args>(args)...), KeyHash(_KeyHash) {}
+	/*!
+	*  \brief Replaces the KeyValue by the one constructed in place from the arguments, rather than assigning a temporary one.
+	*
+	*  If the construction throws, a default KeyValue is constructed instead, so the storage always holds one.
+	*/
+	template <class... Args>
+	void Reconstruct(size_t const _KeyHash, Args&&... args) {
+		this->~HashedPair();
+		try {
+			new (this) HashedPair(_KeyHash, std::forward<Args>(args)...);
+		}
+		catch (...) {
+			new (this) HashedPair();
+			throw;
+		}
+	}
+};
+
+// Snapshot mark of the home Slots, stored within the META_BITS of their Lock below the ones used by the Policies :
+// 0 if the home Slot was never copied to a snapshot, 1 plus the parity of the last snapshot it was copied to otherwise.
+// The Policies preserve it whenever they modify the META_BITS.
+const uint_fast64_t SNAPSHOT_MARK_MASK = 0x00300000;
+#define SNAPSHOT_MARK_SHIFT 20
+
+/*! \struct ChainingPolicy
+* \brief Each Slot stores the KeyValues hashed to it : a Main KeyValue, and the collided ones in an InlineVector.
+*/
+struct ChainingPolicy {
+	template <class K, class T, class Pred, class Alloc>
+	class Engine {
+	public:
+		typedef std::pair<K, T> Pair;
+		typedef HashedPair<K, T> Hashed;
+		// Slot definition
+		struct Slot {
+			AtomicRWLock Lock; // Read-Write Lock
+			Hashed Main;  // Main KeyValue
+			InlineVector<Hashed, INLINE_COLLISION_COUNT, typename Alloc::template rebind<Hashed>::other> Collisions; // Collided KeyValues
+			size_t Epoch = 0U; // Last migration epoch this Slot has been migrated in
+		};
+		struct Shared {};
+		typedef SlotHome<Slot, Shared> Home;
+		// The next Layer is allocated when the size exceeds MaxLoadFactor times the number of Slots.
+		static constexpr double MaxLoadFactor = 1.0;
+		/*!
+		*  \brief Returns the number of fingerprints of a Layer, given its number of Slots : the KeyValues are not fingerprinted.
+		*/
+		static inline size_t FingerprintCount(size_t const) {
+			return 0U;
+		}
+		/*!
+		*  \brief Returns whether the Slots are too loaded to wait for the migration to complete : the collisions grow as needed, so they never are.
+		*/
+		static inline bool IsOverloaded(Shared const&, size_t const) {
+			return false;
+		}
+		/*!
+		*  \brief Returns the KeyValue whose Key is the one passed as argument, nullptr if it is not found.
+		*/
+		static Pair* Find(Home const& CurHome, K const& Key) {
+			auto& CurSlot = CurHome.HomeSlot();
+			// Empty slot : the Key is not found.
+			if (*CurHome.pLockValue == EMPTY) {
+				return nullptr;
+			}
+			// Look in the main value for equal keys.
+			if (CurSlot.Main.KeyHash == CurHome.KeyHash && Pred()(CurSlot.Main.first, Key)) {
+				return &CurSlot.Main;
+			}
+			// Look in the collision vector for equal keys.
+			auto CollisionIt = std::find_if(CurSlot.Collisions.begin(), CurSlot.Collisions.end(), [&](Hashed const& _KeyVal) -> bool {
+				return _KeyVal.KeyHash == CurHome.KeyHash && Pred()(_KeyVal.first, Key);
+			});
+			return CollisionIt == CurSlot.Collisions.end() ? nullptr : &*CollisionIt;
+		}
+		/*!
+		*  \brief Constructs a KeyValue in place from the arguments, whose Key is known not to be stored yet and whose hash is in the Home, and returns it.
+		*/
+		template <class... Args>
+		static Pair* Emplace(Home const& CurHome, Args&&... args) {
+			auto& CurSlot = CurHome.HomeSlot();
+			// If the slot is empty, simply write the new KeyVal in the Main KeyVal.
+			if (*CurHome.pLockValue == EMPTY) {
+				CurSlot.Main.Reconstruct(CurHome.KeyHash, std::forward<Args>(args)...);
+				*CurHome.pLockValue = POPULATED;
+				return &CurSlot.Main;
+			}
+			// Otherwise, append the new KeyVal at the end of the collisions vector.
+			CurSlot.Collisions.emplace_back(CurHome.KeyHash, std::forward<Args>(args)...);
+			return &CurSlot.Collisions.back();
+		}
+		/*!
+		*  \brief Removes the KeyValue passed as argument, as returned by Find().
+		*/
+		static void Erase(Home const& CurHome, Pair* pKeyVal) {
+			auto& CurSlot = CurHome.HomeSlot();
+			// Take the last collision and move it to the erased KeyValue.
+			if (!CurSlot.Collisions.empty()) {
+				SWAP_AND_POP(*static_cast<Hashed*>(pKeyVal), CurSlot.Collisions);
+			}
+			// If there are no collisions, the slot is empty.
+			else {
+				*CurHome.pLockValue = EMPTY;
+			}
+		}
+		/*!
+		*  \brief Calls Func(KeyValue, KeyHash) for each KeyValue of the home Slot, and removes the KeyValues for which it returns true.
+		*
+		*  Func may move the KeyValue away before returning true.
+		*/
+		template <class Fn>
+		static void ExtractIf(Home const& CurHome, Fn&& Func) {
+			auto& CurSlot = CurHome.HomeSlot();
+			if (*CurHome.pLockValue == EMPTY) {
+				return;
+			}
+			// Traverse the Collision vector backwards, so that SWAP_AND_POP does not skip any KeyValue.
+			for (auto CollisionIdx = CurSlot.Collisions.size(); CollisionIdx-- > 0U; ) {
+				if (Func(CurSlot.Collisions[CollisionIdx], CurSlot.Collisions[CollisionIdx].KeyHash)) {
+					SWAP_AND_POP(CurSlot.Collisions[CollisionIdx], CurSlot.Collisions);
+				}
+			}
+			// Then, the Main KeyValue is replaced by the last collision (if any).
+			if (Func(CurSlot.Main, CurSlot.Main.KeyHash)) {
+				Erase(CurHome, &CurSlot.Main);
+			}
+		}
+		/*!
+		*  \brief Calls Func(KeyValue) for each KeyValue of the home Slot, which may only be read-locked.
+		*/
+		template <class Fn>
+		static void ForEach(Home const& CurHome, Fn&& Func) {
+			auto& CurSlot = CurHome.HomeSlot();
+			if (*CurHome.pLockValue == EMPTY) {
+				return;
+			}
+			Func(static_cast<Pair const&>(CurSlot.Main));
+			for (auto& KeyVal : CurSlot.Collisions) {
+				Func(static_cast<Pair const&>(KeyVal));
+			}
+		}
+		/*!
+		*  \brief Prefetches the home Slot, before it is locked.
+		*/
+		static void Prefetch(Home const& CurHome) {
+			PREFETCH(&CurHome.HomeSlot());
+		}
+		/*!
+		*  \brief Looks for the Key passed as argument without locking the home Slot, given the Lock state returned by AtomicRWLock::read_begin().
+		*
+		*  Only the inline collisions can be traversed, as the heap storage may be reallocated meanwhile.
+		*  The Value found is copied unless the pointer passed as argument is null.
+		*  The result is only relevant if AtomicRWLock::read_validate() succeeds afterwards.
+		*/
+		static OptimisticReadStatus FindOptimistic(Home const& CurHome, uint_fast64_t const LockState, K const& Key, T* pValue) {
+			auto& CurSlot = CurHome.HomeSlot();
+			// Empty slot : the Key is not found.
+			if ((LockState & VALUE_BITS_MASK) == EMPTY) {
+				return OPTIMISTIC_NOT_FOUND;
+			}
+			// Look in the main value for equal keys.
+			if (CurSlot.Main.KeyHash == CurHome.KeyHash && Pred()(CurSlot.Main.first, Key)) {
+				if (pValue) {
+					*pValue = CurSlot.Main.second;
+				}
+				return OPTIMISTIC_FOUND;
+			}
+			if (!CurSlot.Collisions.is_inline()) {
+				return OPTIMISTIC_FAILED;
+			}
+			// The collision count is bounded, in case it is read while written.
+			auto pCollisions = CurSlot.Collisions.inline_begin();
+			auto CollisionCount = std::min(CurSlot.Collisions.inline_size(), size_t(INLINE_COLLISION_COUNT));
+			for (size_t CollisionIdx = 0U; CollisionIdx < CollisionCount; ++CollisionIdx) {
+				if (pCollisions[CollisionIdx].KeyHash == CurHome.KeyHash && Pred()(pCollisions[CollisionIdx].first, Key)) {
+					if (pValue) {
+						*pValue = pCollisions[CollisionIdx].second;
+					}
+					return OPTIMISTIC_FOUND;
+				}
+			}
+			return OPTIMISTIC_NOT_FOUND;
+		}
+	};
+};
+
+// Entry state of the OpenAddressingPolicy Slots, stored within the META_BITS of their Lock.
+// OCCUPIED and TOMBSTONE Entries hold (or held) a KeyValue, stored DISTANCE Slots after its home Slot in the Layer.
+// OVERFLOW is set on a home Slot whose KeyValues did not all fit within PROBE_LENGTH Slots, so some of them are stashed.
+const uint_fast64_t OCCUPIED_BIT_MASK = 0x20000000, TOMBSTONE_BIT_MASK = 0x10000000, OVERFLOW_BIT_MASK = 0x08000000, DISTANCE_MASK = 0x07C00000;
+const uint_fast64_t ENTRY_BITS_MASK = OCCUPIED_BIT_MASK | TOMBSTONE_BIT_MASK | DISTANCE_MASK;
+static_assert(((ENTRY_BITS_MASK | OVERFLOW_BIT_MASK | SNAPSHOT_MARK_MASK) & ~META_BITS_MASK) == 0 && ((ENTRY_BITS_MASK | OVERFLOW_BIT_MASK) & SNAPSHOT_MARK_MASK) == 0,
+			  "The Entry state and the snapshot mark must fit apart within the META_BITS.");
+#define DISTANCE_SHIFT 22
+
+/*! \struct OpenAddressingPolicy
+* \brief Each Slot stores a single KeyValue, within PROBE_LENGTH Slots from its home Slot (linear probing within the Layer).
+*
+*  Each Slot is both an Entry, holding a KeyValue, and the home Slot of the Keys hashed to it, whose Lock protects them.
+*  An Entry is claimed with a CAS-operation on the META_BITS of its Lock, so it is never used by two home Slots at once.
+*  Erased Entries become TOMBSTONEs : the probing stops at the first EMPTY Entry, as no KeyValue was ever stored beyond it.
+*  The KeyValues which do not fit within PROBE_LENGTH Slots are stored in a stash shared by the whole LayeredHashMap.
+*  Each Layer keeps a parallel array of 1-byte fingerprints, so the KeyValues are only compared on a fingerprint match.
+*/
+struct OpenAddressingPolicy {
+	template <class K, class T, class Pred, class Alloc>
+	class Engine {
+	public:
+		typedef std::pair<K, T> Pair;
+		typedef HashedPair<K, T> Hashed;
+		// Slot definition
+		struct Slot {
+			AtomicRWLock Lock; // Read-Write Lock of the home Slot, along with the Entry state in its META_BITS
+			Hashed KeyVal; // KeyValue of the Entry
+			size_t Epoch = 0U; // Last migration epoch this Slot has been migrated in
+		};
+		// Stashed KeyValues, indexed by their home Slot.
+		typedef std::unordered_multimap<const Slot*, Hashed, std::hash<const Slot*>, std::equal_to<const Slot*>,
+										typename Alloc::template rebind<std::pair<const Slot* const, Hashed> >::other> StashMap;
+		struct Shared {
+			AtomicLock StashLock; // Lock of the stash
+			StashMap Stash; // KeyValues which did not fit within PROBE_LENGTH Slots
+			std::atomic<size_t> StashSize; // Number of stashed KeyValues, read without the StashLock
+			Shared() : StashSize(0U) {}
+		};
+		typedef SlotHome<Slot, Shared> Home;
+		// The next Layer is allocated when the size exceeds MaxLoadFactor times the number of Slots, so the probing sequences stay short.
+		static constexpr double MaxLoadFactor = 0.5;
+		/*!
+		*  \brief Returns whether the Slots are too loaded to wait for the migration to complete, given the number of Slots passed as argument.
+		*
+		*  The stash only holds a few KeyValues under MaxLoadFactor : it grows once the insertions outpace the migration.
+		*/
+		static inline bool IsOverloaded(Shared const& _Shared, size_t const SlotCount) {
+			return (_Shared.StashSize.load(std::memory_order_relaxed) << 6) > SlotCount;
+		}
+		/*!
+		*  \brief Returns the number of fingerprints of a Layer, given its number of Slots.
+		*
+		*  The fingerprints of the first Slots are cloned after the last ones, so a group of fingerprints never wraps around the Layer.
+		*/
+		static inline size_t FingerprintCount(size_t const LayerSize) {
+			return LayerSize + FINGERPRINT_GROUP;
+		}
+	private:
+		static_assert(PROBE_LENGTH > 0 && PROBE_LENGTH <= (DISTANCE_MASK >> DISTANCE_SHIFT) + 1, "PROBE_LENGTH must fit within the DISTANCE_MASK bits.");
+		static_assert(PROBE_LENGTH <= FINGERPRINT_GROUP, "PROBE_LENGTH must fit within a group of fingerprints.");
+		/*!
+		*  \brief Returns the index of the Slot at the distance passed as argument from the home Slot, wrapping around the Layer.
+		*/
+		static inline size_t ProbeIdx(Home const& CurHome, size_t const Distance) {
+			auto SlotIdx = CurHome.SlotIdx + Distance;
+			return SlotIdx < CurHome.LayerSize ? SlotIdx : SlotIdx - CurHome.LayerSize;
+		}
+		static inline Slot& Probe(Home const& CurHome, size_t const Distance) {
+			return CurHome.pLayer[ProbeIdx(CurHome, Distance)];
+		}
+		/*!
+		*  \brief Returns whether the Entry state passed as argument is OCCUPIED by a KeyValue of the home Slot at the distance passed as argument.
+		*/
+		static inline bool IsHomed(uint_fast64_t const Meta, size_t const Distance) {
+			return (Meta & (OCCUPIED_BIT_MASK | DISTANCE_MASK)) == (OCCUPIED_BIT_MASK | (uint_fast64_t(Distance) << DISTANCE_SHIFT));
+		}
+		static inline bool IsEmpty(uint_fast64_t const Meta) {
+			return !(Meta & (OCCUPIED_BIT_MASK | TOMBSTONE_BIT_MASK));
+		}
+		/*!
+		*  \brief Sets the fingerprint of the Slot at the distance passed as argument from the home Slot, and its clone if any.
+		*
+		*  The other home Slots whose probing sequence covers the Slot may read its fingerprint meanwhile : it is written by a relaxed store.
+		*/
+		static inline void SetFingerprint(Home const& CurHome, size_t const Distance, uint8_t const Fp) {
+			auto SlotIdx = ProbeIdx(CurHome, Distance);
+			CurHome.pFingerprints[SlotIdx].store(Fp, std::memory_order_relaxed);
+			if (SlotIdx < PROBE_LENGTH) {
+				CurHome.pFingerprints[CurHome.LayerSize + SlotIdx].store(Fp, std::memory_order_relaxed);
+			}
+		}
+		/*!
+		*  \brief Returns the mask of the distances from the home Slot where the Key whose hash is in the Home may be stored.
+		*
+		*  The fingerprints are only hints : the Entry state of each candidate is checked afterwards.
+		*  The EMPTY fingerprints cannot bound the candidates, as an Entry claimed by another home Slot gets its fingerprint after its state.
+		*/
+		static inline uint32_t Candidates(Home const& CurHome) {
+			return MatchFingerprints(CurHome.pFingerprints + CurHome.SlotIdx, Fingerprint(CurHome.KeyHash));
+		}
+		/*!
+		*  \brief Turns the Entry at the distance passed as argument from the home Slot into a TOMBSTONE, keeping its OVERFLOW_BIT as it belongs to the home Slot.
+		*
+		*  The fingerprint is written first, so it cannot overwrite the one of a KeyValue claiming the Entry afterwards.
+		*/
+		static void Vacate(Home const& CurHome, size_t const Distance) {
+			auto& Entry = Probe(CurHome, Distance);
+			Entry.KeyVal = Hashed();
+			SetFingerprint(CurHome, Distance, TOMBSTONE_FINGERPRINT);
+			auto Meta = Entry.Lock.meta();
+			while (!Entry.Lock.compare_exchange_meta(Meta, (Meta & ~ENTRY_BITS_MASK) | TOMBSTONE_BIT_MASK));
+		}
+		/*!
+		*  \brief Sets the OVERFLOW_BIT of the home Slot if some of its KeyValues are stashed, clears it otherwise, and updates the StashSize.
+		*
+		*  The StashLock must be held.
+		*/
+		static void UpdateOverflow(Home const& CurHome) {
+			CurHome.pShared->StashSize.store(CurHome.pShared->Stash.size(), std::memory_order_relaxed);
+			auto pHomeSlot = &CurHome.HomeSlot();
+			auto Overflow = CurHome.pShared->Stash.count(pHomeSlot) ? OVERFLOW_BIT_MASK : EMPTY;
+			auto Meta = pHomeSlot->Lock.meta();
+			while ((Meta & OVERFLOW_BIT_MASK) != Overflow && !pHomeSlot->Lock.compare_exchange_meta(Meta, (Meta & ~OVERFLOW_BIT_MASK) | Overflow));
+		}
+	public:
+		/*!
+		*  \brief Returns the KeyValue whose Key is the one passed as argument, nullptr if it is not found.
+		*/
+		static Pair* Find(Home const& CurHome, K const& Key) {
+			// Only the Entries whose fingerprint matches are compared.
+			// The KeyValues of other home Slots are skipped : they may be written meanwhile.
+			for (auto Mask = Candidates(CurHome); Mask; Mask &= Mask - 1U) {
+				auto Distance = LowestBitIdx(Mask);
+				auto& Entry = Probe(CurHome, Distance);
+				if (IsHomed(Entry.Lock.meta(), Distance) && Entry.KeyVal.KeyHash == CurHome.KeyHash && Pred()(Entry.KeyVal.first, Key)) {
+					return &Entry.KeyVal;
+				}
+			}
+			if (CurHome.HomeSlot().Lock.meta() & OVERFLOW_BIT_MASK) {
+				std::lock_guard<AtomicLock> lock(CurHome.pShared->StashLock);
+				auto StashRange = CurHome.pShared->Stash.equal_range(&CurHome.HomeSlot());
+				for (auto StashIt = StashRange.first; StashIt != StashRange.second; ++StashIt) {
+					if (StashIt->second.KeyHash == CurHome.KeyHash && Pred()(StashIt->second.first, Key)) {
+						return &StashIt->second;
+					}
+				}
+			}
+			return nullptr;
+		}
+		/*!
+		*  \brief Constructs a KeyValue in place from the arguments, whose Key is known not to be stored yet and whose hash is in the Home, and returns it.
+		*/
+		template <class... Args>
+		static Pair* Emplace(Home const& CurHome, Args&&... args) {
+			for (size_t Distance = 0U; Distance < PROBE_LENGTH; ++Distance) {
+				auto& Entry = Probe(CurHome, Distance);
+				auto Meta = Entry.Lock.meta();
+				// Claim the first EMPTY or TOMBSTONE Entry : the fingerprint and the KeyValue are written afterwards, as the KeyValues
+				// of this home Slot are only read once its Lock is acquired.
+				while (!(Meta & OCCUPIED_BIT_MASK)) {
+					if (Entry.Lock.compare_exchange_meta(Meta, (Meta & ~ENTRY_BITS_MASK) | OCCUPIED_BIT_MASK | (uint_fast64_t(Distance) << DISTANCE_SHIFT))) {
+						SetFingerprint(CurHome, Distance, Fingerprint(CurHome.KeyHash));
+						try {
+							Entry.KeyVal.Reconstruct(CurHome.KeyHash, std::forward<Args>(args)...);
+						}
+						catch (...) {
+							Vacate(CurHome, Distance);
+							throw;
+						}
+						return &Entry.KeyVal;
+					}
+				}
+			}
+			// No Entry is available within PROBE_LENGTH Slots : stash the KeyValue.
+			std::lock_guard<AtomicLock> lock(CurHome.pShared->StashLock);
+			auto StashIt = CurHome.pShared->Stash.emplace(std::piecewise_construct, std::forward_as_tuple(&CurHome.HomeSlot()),
+														  std::forward_as_tuple(CurHome.KeyHash, std::forward<Args>(args)...));
+			UpdateOverflow(CurHome);
+			return &StashIt->second;
+		}
+		/*!
+		*  \brief Removes the KeyValue passed as argument, as returned by Find().
+		*/
+		static void Erase(Home const& CurHome, Pair* pKeyVal) {
+			for (size_t Distance = 0U; Distance < PROBE_LENGTH; ++Distance) {
+				if (&Probe(CurHome, Distance).KeyVal == pKeyVal) {
+					Vacate(CurHome, Distance);
+					return;
+				}
+			}
+			std::lock_guard<AtomicLock> lock(CurHome.pShared->StashLock);
+			auto StashRange = CurHome.pShared->Stash.equal_range(&CurHome.HomeSlot());
+			for (auto StashIt = StashRange.first; StashIt != StashRange.second; ++StashIt) {
+				if (&StashIt->second == pKeyVal) {
+					CurHome.pShared->Stash.erase(StashIt);
+					break;
+				}
+			}
+			UpdateOverflow(CurHome);
+		}
+		/*!
+		*  \brief Calls Func(KeyValue, KeyHash) for each KeyValue of the home Slot, and removes the KeyValues for which it returns true.
+		*
+		*  Func may move the KeyValue away before returning true.
+		*/
+		template <class Fn>
+		static void ExtractIf(Home const& CurHome, Fn&& Func) {
+			for (size_t Distance = 0U; Distance < PROBE_LENGTH; ++Distance) {
+				auto Meta = Probe(CurHome, Distance).Lock.meta();
+				if (IsEmpty(Meta)) {
+					break;
+				}
+				auto& KeyVal = Probe(CurHome, Distance).KeyVal;
+				if (IsHomed(Meta, Distance) && Func(KeyVal, KeyVal.KeyHash)) {
+					Vacate(CurHome, Distance);
+				}
+			}
+			if (!(CurHome.HomeSlot().Lock.meta() & OVERFLOW_BIT_MASK)) {
+				return;
+			}
+			// Take the stashed KeyValues out of the stash first, as Func may stash KeyValues itself. The kept ones are then stashed again.
+			std::vector<Hashed, typename Alloc::template rebind<Hashed>::other> Extracted;
+			{
+				std::lock_guard<AtomicLock> lock(CurHome.pShared->StashLock);
+				auto StashRange = CurHome.pShared->Stash.equal_range(&CurHome.HomeSlot());
+				for (auto StashIt = StashRange.first; StashIt != StashRange.second; ++StashIt) {
+					Extracted.push_back(std::move(StashIt->second));
+				}
+				CurHome.pShared->Stash.erase(StashRange.first, StashRange.second);
+				UpdateOverflow(CurHome);
+			}
+			for (auto& KeyVal : Extracted) {
+				if (!Func(KeyVal, KeyVal.KeyHash)) {
+					std::lock_guard<AtomicLock> lock(CurHome.pShared->StashLock);
+					CurHome.pShared->Stash.emplace(&CurHome.HomeSlot(), std::move(KeyVal));
+					UpdateOverflow(CurHome);
+				}
+			}
+		}
+		/*!
+		*  \brief Calls Func(KeyValue) for each KeyValue of the home Slot, which may only be read-locked.
+		*
+		*  The stashed KeyValues are visited while holding the stash Lock.
+		*/
+		template <class Fn>
+		static void ForEach(Home const& CurHome, Fn&& Func) {
+			for (size_t Distance = 0U; Distance < PROBE_LENGTH; ++Distance) {
+				auto Meta = Probe(CurHome, Distance).Lock.meta();
+				if (IsEmpty(Meta)) {
+					break;
+				}
+				if (IsHomed(Meta, Distance)) {
+					Func(static_cast<Pair const&>(Probe(CurHome, Distance).KeyVal));
+				}
+			}
+			if (CurHome.HomeSlot().Lock.meta() & OVERFLOW_BIT_MASK) {
+				std::lock_guard<AtomicLock> lock(CurHome.pShared->StashLock);
+				auto StashRange = CurHome.pShared->Stash.equal_range(&CurHome.HomeSlot());
+				for (auto StashIt = StashRange.first; StashIt != StashRange.second; ++StashIt) {
+					Func(static_cast<Pair const&>(StashIt->second));
+				}
+			}
+		}
+		/*!
+		*  \brief Prefetches the fingerprints of the probed Slots and the home Slot, before it is locked.
+		*/
+		static void Prefetch(Home const& CurHome) {
+			PREFETCH(CurHome.pFingerprints + CurHome.SlotIdx);
+			PREFETCH(&CurHome.HomeSlot());
+		}
+		/*!
+		*  \brief Looks for the Key passed as argument without locking the home Slot, given the Lock state returned by AtomicRWLock::read_begin().
+		*
+		*  The stash cannot be traversed without its Lock. The Value found is copied unless the pointer passed as argument is null.
+		*  The result is only relevant if AtomicRWLock::read_validate() succeeds afterwards.
+		*/
+		static OptimisticReadStatus FindOptimistic(Home const& CurHome, uint_fast64_t const LockState, K const& Key, T* pValue) {
+			for (auto Mask = Candidates(CurHome); Mask; Mask &= Mask - 1U) {
+				auto Distance = LowestBitIdx(Mask);
+				auto& Entry = Probe(CurHome, Distance);
+				if (IsHomed(Entry.Lock.meta(), Distance) && Entry.KeyVal.KeyHash == CurHome.KeyHash && Pred()(Entry.KeyVal.first, Key)) {
+					if (pValue) {
+						*pValue = Entry.KeyVal.second;
+					}
+					return OPTIMISTIC_FOUND;
+				}
+			}
+			return (LockState & OVERFLOW_BIT_MASK) ? OPTIMISTIC_FAILED : OPTIMISTIC_NOT_FOUND;
+		}
+	};
+};
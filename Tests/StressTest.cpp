@@ -0,0 +1,156 @@
+#include "LayeredHashMap.h"
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+// Concurrent smoke test of both Slot policies : the writers grow the LayeredHashMap, then shrink it, then rewrite it,
+// while other threads read it, walk it with ForEach() and take snapshots. The exit code is non-zero if any check failed.
+
+#define WRITER_COUNT 4
+#define KEY_COUNT 100000 // Keys written by each writer
+#define KEPT_KEY_STEP 100 // Every KEPT_KEY_STEP-th Key is kept by the shrink phase
+#define REWRITE_ROUND_COUNT 50
+
+static std::atomic<int> Failures(0);
+
+#define CHECK(Condition)	{  if (!(Condition)) {														\
+								   std::printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #Condition);	\
+								   Failures.fetch_add(1, std::memory_order_relaxed);						\
+							   } }
+
+// While the writers grow and shrink the map, each Key is either missing or stored with its own Value.
+static inline size_t ValueOf(size_t const Key) {
+	return Key * 2U + 1U;
+}
+
+static inline size_t KeyOf(size_t const WriterIdx, size_t const KeyIdx) {
+	return WriterIdx * KEY_COUNT + KeyIdx;
+}
+
+// Runs WRITER_COUNT writers along with a reader and a walker, which keep on checking the map until the writers return.
+template <class Map, class WriterFn, class ReaderFn, class WalkerFn>
+static void RunConcurrently(Map&, WriterFn&& Writer, ReaderFn&& Reader, WalkerFn&& Walker) {
+	std::atomic<size_t> RunningWriters(WRITER_COUNT);
+	std::vector<std::thread> Threads;
+	for (size_t WriterIdx = 0U; WriterIdx < WRITER_COUNT; ++WriterIdx) {
+		Threads.emplace_back([&, WriterIdx] {
+			Writer(WriterIdx);
+			RunningWriters.fetch_sub(1U);
+		});
+	}
+	Threads.emplace_back([&] {
+		do {
+			Reader();
+		} while (RunningWriters.load());
+	});
+	Threads.emplace_back([&] {
+		do {
+			Walker();
+		} while (RunningWriters.load());
+	});
+	for (auto& CurThread : Threads) {
+		CurThread.join();
+	}
+}
+
+template <class Map>
+static void CheckGrowAndShrink(Map& TestMap) {
+	// Each KeyValue found must be stored once, with its own Value.
+	auto Reader = [&] {
+		size_t Value;
+		for (size_t Key = 0U; Key < WRITER_COUNT * KEY_COUNT; Key += 7U) {
+			if (TestMap.TryRead(Key, Value)) {
+				CHECK(Value == ValueOf(Key));
+			}
+			TestMap.Contains(Key);
+		}
+	};
+	auto Walker = [&] {
+		std::unordered_set<size_t> Keys;
+		TestMap.ForEach([&](size_t const& Key, size_t const& Value) {
+			CHECK(Value == ValueOf(Key));
+			CHECK(Keys.insert(Key).second);
+		});
+		Keys.clear();
+		for (auto const& KeyVal : TestMap.Snapshot()) {
+			CHECK(KeyVal.second == ValueOf(KeyVal.first));
+			CHECK(Keys.insert(KeyVal.first).second);
+		}
+	};
+	// Grow the map from a single Layer.
+	RunConcurrently(TestMap, [&](size_t const WriterIdx) {
+		for (size_t KeyIdx = 0U; KeyIdx < KEY_COUNT; ++KeyIdx) {
+			TestMap.Write(KeyOf(WriterIdx, KeyIdx), ValueOf(KeyOf(WriterIdx, KeyIdx)));
+		}
+	}, Reader, Walker);
+	CHECK(TestMap.GetSize() == WRITER_COUNT * KEY_COUNT);
+	CHECK(TestMap.Snapshot().size() == WRITER_COUNT * KEY_COUNT);
+	// Shrink it back, deleting all the Keys but every KEPT_KEY_STEP-th one.
+	RunConcurrently(TestMap, [&](size_t const WriterIdx) {
+		for (size_t KeyIdx = 0U; KeyIdx < KEY_COUNT; ++KeyIdx) {
+			if (KeyIdx % KEPT_KEY_STEP) {
+				CHECK(TestMap.Delete(KeyOf(WriterIdx, KeyIdx)));
+			}
+		}
+	}, Reader, Walker);
+	CHECK(TestMap.GetSize() == WRITER_COUNT * KEY_COUNT / KEPT_KEY_STEP);
+	for (size_t Key = 0U; Key < WRITER_COUNT * KEY_COUNT; ++Key) {
+		CHECK(TestMap.Contains(Key) == !(Key % KEPT_KEY_STEP));
+	}
+}
+
+template <class Map>
+static void CheckSnapshotConsistency(Map& TestMap) {
+	// Each writer rewrites its kept Keys in increasing order, with the round index as Value : at any point in time, the Values
+	// of a writer decrease by at most 1 along its Keys, so does any consistent snapshot. ForEach() visits each Key once, as none is deleted.
+	auto const KeptCount = KEY_COUNT / KEPT_KEY_STEP;
+	RunConcurrently(TestMap, [&](size_t const WriterIdx) {
+		for (size_t Round = 1U; Round <= REWRITE_ROUND_COUNT; ++Round) {
+			for (size_t KeyIdx = 0U; KeyIdx < KEY_COUNT; KeyIdx += KEPT_KEY_STEP) {
+				TestMap.Write(KeyOf(WriterIdx, KeyIdx), Round);
+			}
+		}
+	}, [&] {
+		size_t Value;
+		CHECK(TestMap.TryRead(KeyOf(WRITER_COUNT - 1U, 0U), Value));
+	}, [&] {
+		size_t VisitCount = 0U;
+		TestMap.ForEach([&](size_t const&, size_t const&) {
+			++VisitCount;
+		});
+		CHECK(VisitCount == WRITER_COUNT * KeptCount);
+		std::vector<size_t> Values(WRITER_COUNT * KEY_COUNT);
+		auto KeyVals = TestMap.Snapshot();
+		CHECK(KeyVals.size() == WRITER_COUNT * KeptCount);
+		for (auto const& KeyVal : KeyVals) {
+			Values[KeyVal.first] = KeyVal.second;
+		}
+		for (size_t WriterIdx = 0U; WriterIdx < WRITER_COUNT; ++WriterIdx) {
+			auto FirstValue = Values[KeyOf(WriterIdx, 0U)];
+			for (size_t KeyIdx = KEPT_KEY_STEP; KeyIdx < KEY_COUNT; KeyIdx += KEPT_KEY_STEP) {
+				auto Value = Values[KeyOf(WriterIdx, KeyIdx)];
+				CHECK(Value <= Values[KeyOf(WriterIdx, KeyIdx - KEPT_KEY_STEP)] && Value + 1U >= FirstValue);
+			}
+		}
+	});
+	for (size_t Key = 0U; Key < WRITER_COUNT * KEY_COUNT; Key += KEPT_KEY_STEP) {
+		CHECK(TestMap.Read(Key) == REWRITE_ROUND_COUNT);
+	}
+}
+
+template <class Policy>
+static void RunStressTest(const char* PolicyName) {
+	auto FailureCount = Failures.load();
+	LayeredHashMap<size_t, size_t, LayeredHash<size_t>, std::equal_to<size_t>, std::allocator<size_t>, Policy> TestMap;
+	CheckGrowAndShrink(TestMap);
+	CheckSnapshotConsistency(TestMap);
+	std::printf("%s: %s\n", PolicyName, Failures.load() == FailureCount ? "passed" : "FAILED");
+}
+
+int main() {
+	RunStressTest<ChainingPolicy>("ChainingPolicy");
+	RunStressTest<OpenAddressingPolicy>("OpenAddressingPolicy");
+	return Failures.load() ? 1 : 0;
+}
@@ -28,20 +28,26 @@ Created by: Matthieu Pinard, Ecole des Mines de Saint-Etienne, matthieu.pinard@e
 // uInt = unsigned type
 // uInt and sInt have the same size, the size of size_t.
 #if (defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_AMD64)))
+#include <intrin.h>
 	#if defined(_M_IX86) 
 		typedef long sInt;
 		typedef unsigned long uInt;
 		#define ALIGNED __declspec(align(4)) // Intel 8.1.1: 32-bits RW on 32-bit aligned memory are atomic.
+		#define ADD(X, Val) (_InterlockedExchangeAdd(&(X), (Val)))
 	#elif defined(_M_AMD64)
 		typedef long long sInt;
 		typedef unsigned long long uInt;
 		#define ALIGNED __declspec(align(8)) // Intel 8.1.1: 64-bits RW on 64-bit aligned memory are atomic.
+		#define ADD(X, Val) (_InterlockedExchangeAdd64(&(X), (Val)))
 	#endif
 	typedef sInt _sInt;
 	#define ATOMIC_WRITE(X, Val) (X = (Val))
 	#define ATOMIC_READ(X) X
-	#define INCREMENT(X) (++X)
-	#define DECREMENT(X) (--X)
+	// A volatile read-modify-write is not atomic : use the interlocked intrinsics, which return the previous value like fetch_add().
+	#define INCREMENT(X) ADD(X, 1)
+	#define DECREMENT(X) ADD(X, -1)
+	#define RELAXED_READ(X) X
+	#define RELAXED_WRITE(X, Val) (X = (Val))
 	#define VOLATILE volatile // Microsoft specific: Volatile reads have acquire semantics, volatile writes have release semantics.
 #else
 #include <atomic>
@@ -52,6 +58,63 @@ Created by: Matthieu Pinard, Ecole des Mines de Saint-Etienne, matthieu.pinard@e
 	#define ATOMIC_WRITE(X, Val) ((X).store(Val, std::memory_order::memory_order_release))
 	#define INCREMENT(X) ((X).fetch_add(1, std::memory_order::memory_order_release))
 	#define DECREMENT(X) ((X).fetch_add(-1, std::memory_order::memory_order_release))
+	#define ADD(X, Val) ((X).fetch_add(Val, std::memory_order::memory_order_release))
+	// For the fields written by a single thread : no ordering, and a read-modify-write is a plain load and store.
+	#define RELAXED_READ(X) ((X).load(std::memory_order::memory_order_relaxed))
+	#define RELAXED_WRITE(X, Val) ((X).store(Val, std::memory_order::memory_order_relaxed))
 	#define ALIGNED
 	#define VOLATILE
-#endif
\ No newline at end of file
+#endif
+
+// Asymmetric fences : LightFence() on the frequent side and HeavyFence() on the rare side order the stores before them
+// with the loads after them, as a pair of sequentially consistent fences does, but LightFence() only restrains the compiler.
+// HeavyFence() makes every running thread of the process execute a full fence, so it is costly.
+#include <atomic>
+#if defined(_MSC_VER)
+	extern "C" __declspec(dllimport) void __stdcall FlushProcessWriteBuffers(void);
+	inline bool HasHeavyFence() {
+		return true;
+	}
+	inline void HeavyFence() {
+		FlushProcessWriteBuffers();
+	}
+#else
+	#if defined(__linux__) && defined(__has_include)
+		#if __has_include(<linux/membarrier.h>)
+			#define HEAVY_FENCE_MEMBARRIER
+		#endif
+	#endif
+	#if defined(HEAVY_FENCE_MEMBARRIER)
+		#include <linux/membarrier.h>
+		#include <sys/syscall.h>
+		#include <unistd.h>
+		inline bool HasHeavyFence() {
+			// The process registers once, before its first expedited membarrier ; older kernels refuse it.
+			static const bool Registered = syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0;
+			return Registered;
+		}
+		inline void HeavyFence() {
+			if (HasHeavyFence()) {
+				syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0);
+			}
+			else {
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+			}
+		}
+	#else
+		inline bool HasHeavyFence() {
+			return false;
+		}
+		inline void HeavyFence() {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+		}
+	#endif
+#endif
+inline void LightFence() {
+	if (HasHeavyFence()) {
+		std::atomic_signal_fence(std::memory_order_seq_cst);
+	}
+	else {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	}
+}
\ No newline at end of file
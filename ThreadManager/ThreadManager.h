@@ -27,11 +27,28 @@ Created by: Matthieu Pinard, Ecole des Mines de Saint-Etienne, matthieu.pinard@e
 #include <vector>
 #include <algorithm>
 #include <mutex>
+#include <utility>
+#include <thread>
+#include <atomic>
 #include "AtomicLock.h"
 #include "PlatformAtomic.h"
 
 const double MAX_ERROR = 0.00001; /* 0.001 error rate % */
 
+// Number of ThreadValues cached by each thread, see ThreadManager::LocalValue().
+#ifndef THREAD_VALUE_CACHE_SIZE
+#define THREAD_VALUE_CACHE_SIZE 8
+#endif
+
+// Size of a cache line : the fields of a ThreadValue written by different threads are kept CACHE_LINE_SIZE bytes apart.
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+// States of a ThreadValue : owned by a running thread, being released by its exiting thread, released and waiting for
+// another thread to reuse it, or left to its owner thread by a destroyed ThreadManager, see ThreadManager::AcquireThreadValue().
+enum ThreadValueState { THREAD_VALUE_OWNED, THREAD_VALUE_RELEASING, THREAD_VALUE_RELEASED, THREAD_VALUE_ORPHANED };
+
 /*! \class ThreadValue
 * \brief Thread-local storage class.
 *
@@ -46,49 +63,87 @@ class ThreadManager;
 
 class ThreadManager {
 public://private:
-	_sInt DTOR_ThreadValuesSum; /*!< The signed integer storing the sum of deleted ThreadValues */
-	std::vector<ThreadValue*> ThreadValues; /*!< The vector containing pointers to ThreadValue objects */
+	uInt Id; /*!< The identifier of the ThreadManager, never reused by another ThreadManager */
+	// The ThreadValues are only prepended while holding the ManagerLock, so the list can be walked without locking.
+	std::atomic<ThreadValue*> FirstThreadValue; /*!< The first ThreadValue of the list of ThreadValues, owned by the ThreadManager */
+	uInt ThreadValueCount; /*!< The number of ThreadValues owned by a running thread, which share the margins to the "goal" global values */
+	bool SingleWriterValues; /*!< Whether the ThreadValues are modified by a relaxed load and store, see SetSingleWriter() */
+	std::atomic<uInt> LastGlobalValue; /*!< The global value computed by the last update, see ApproximateGlobalValue() */
 	AtomicLock ManagerLock; /*!< The Lock used to complete Thread-safe operations on the structure */
-	AtomicLock ValueLock;
-	std::unique_lock<AtomicLock> ValueUniqueLock; /*!< The Lock used to retrieve the exact sum of ThreadValues, as it blocks subsequent Increments and Decrements */
-	std::function<uInt(uInt)> Callback; /*!< The user-defined Callback called each time the ThreadManager is updated.
-										It takes the global value (= sum of ThreadValues) as argument and returns a "goal" global value for the next update. */
+	std::function<std::pair<uInt, uInt>(uInt)> Callback; /*!< The user-defined Callback called each time the ThreadManager is updated.
+										It takes the global value (= sum of ThreadValues) as argument and returns a pair of "goal" global values (lower, upper) for the next update. */
 	/*!
 	*  \brief Update the ThreadManager class from a Single-Thread context. 
 	*  The public available function is UpdateManager(), which is MT-safe.
 	*
-	*  This method computes the global value (= sum of ThreadValues), calls the Callback function to retrieve the new "goal" global value from the current global value,
-	*  and sets new thresholds for ThreadValues, so that the next update will happen near the "goal" global value.
+	*  This method computes the global value (= sum of ThreadValues), calls the Callback function to retrieve the new "goal" global values from the current global value,
+	*  and sets new thresholds for ThreadValues, so that the next update will happen near one of the "goal" global values.
 	*/
 	void _UpdateManagerInternal();
 	/*!
-	*  \brief Block any subsequent calls to Increment() or Decrement() for any ThreadValue while the ValueUniqueLock is hold.
+	*  \brief Calls the function passed as argument on each ThreadValue, without locking.
+	*/
+	template<class Fn>
+	inline void ForEachThreadValue(Fn&& fn) const;
+	/*!
+	*  \brief Returns a new ThreadManager identifier.
+	*/
+	static uInt NewId() {
+		static std::atomic<uInt> NextId(1U);
+		return NextId.fetch_add(1U, std::memory_order_relaxed);
+	}
+	/*!
+	*  \brief Deletes the released ThreadValues, and leaves the owned ones to their thread, which deletes them when it exits.
+	*
+	*  A thread releasing its ThreadValue meanwhile is waited for.
+	*/
+	void DeleteThreadValues();
+	/*!
+	*  \brief The ThreadValues owned by a thread, along with the Id of their ThreadManager, released when the thread exits.
+	*/
+	struct OwnedThreadValues {
+		std::vector<std::pair<uInt, ThreadValue*> > Entries;
+		~OwnedThreadValues();
+	};
+	/*!
+	*  \brief Returns the ThreadValues owned by the calling thread.
+	*/
+	static OwnedThreadValues& LocalOwnedValues() {
+		static thread_local OwnedThreadValues Owned;
+		return Owned;
+	}
+	/*!
+	*  \brief Returns the ThreadValue of the calling thread in a thread-safe way, acquiring one if the thread has none yet.
 	*
+	*  The ThreadValue of the thread is looked for among the ThreadValues it owns, without locking.
+	*  Otherwise the ThreadValue released by an exited thread is reused, if any, or a new one is appended : its Value is kept,
+	*  as it still counts the changes made by the exited thread.
+	*  An acquired ThreadValue updates the ThreadManager, as a higher thread count implies smaller thresholds for the ThreadValues.
+	*/
+	ThreadValue& AcquireThreadValue();
+	/*!
+	*  \brief Updates the ThreadManager in a thread-safe way once a thread released its ThreadValue, as its margin is shared by fewer threads.
 	*/
-	inline void WaitForGlobalValue() const;
+	void ReleaseThreadValue();
 public:
 	/*!
 	*  \brief ThreadManager constructor.
 	*
 	*  The contructor defines a "standard" Callback function for subsequent ThreadValue initializations, this Callback can still be modified by the SetCallback() method.
 	*/
-	ThreadManager() : DTOR_ThreadValuesSum(0), ValueUniqueLock(std::unique_lock<AtomicLock>(ValueLock, std::defer_lock)) {
-		Callback = [](uInt) -> uInt {
-			return Primes[0];
+	ThreadManager() : Id(NewId()), FirstThreadValue(nullptr), ThreadValueCount(0U), SingleWriterValues(true), LastGlobalValue(0U) {
+		Callback = [](uInt) -> std::pair<uInt, uInt> {
+			return std::make_pair(uInt(0), uInt(Primes[0]));
 		};
 	}
 	/*!
-	*  \brief Put the ThreadManager in its initial state.
+	*  \brief ThreadManager destructor.
 	*
-	* It does not re-initialize ThreadValues, as it would cause problems for ThreadValue DTOR.
+	*  No thread may use the ThreadManager meanwhile, but the threads may exit meanwhile.
 	*/
-	void Reset() {
-		DTOR_ThreadValuesSum = 0;
-		ValueUniqueLock = std::unique_lock<AtomicLock>(ValueLock, std::defer_lock);
-		Callback = [](uInt) -> uInt {
-			return Primes[0];
-		};
-	}    
+	~ThreadManager() {
+		DeleteThreadValues();
+	}
 	/*!
 	*  \brief Sets the Callback function for the ThreadManager instance.
 	*
@@ -96,109 +151,272 @@ public:
 	template<class Fn>
 	void SetCallback(Fn&& fn);
 	/*!
-	*  \brief Remove the ThreadValue from the ThreadManager in a thread-safe way.
+	*  \brief Sets how the ThreadValues modify their Value, for the existing and the subsequent ThreadValues.
 	*
-	*  Deletes the ThreadValue given as argument from the ThreadValues vector, after adding its Value to the DTOR_ThreadValuesSum field.
+	*  Each Value is only modified by its owner thread, so by default it is modified by a relaxed load and store rather than
+	*  an atomic read-modify-write. Passing false restores the read-modify-write with release ordering.
 	*/
-	void DestructThreadValue(ThreadValue*); 
+	void SetSingleWriter(bool);
 	/*!
-	*  \brief Append the ThreadValue to the ThreadManager in a thread-safe way.
+	*  \brief Returns the ThreadValue of the calling thread, which is created on first use.
 	*
-	*  Appends the ThreadValue given as argument to the ThreadValues vector, and updates the ThreadManager, as a higher thread count 
-	*  implies smaller thresholds for the ThreadValues.
+	*  Each thread caches its THREAD_VALUE_CACHE_SIZE most recently used ThreadValues, along with their ThreadManager Id.
+	*  A cache miss looks for the ThreadValue without locking, see AcquireThreadValue().
+	*  The ThreadValues of a thread are released when it exits : their Value keeps on counting, until another thread reuses them.
 	*/
-	void ConstructThreadValue(ThreadValue*);
+	inline ThreadValue& LocalValue();
 	/*!
 	*  \brief Update the ThreadManager in a thread-safe way.
 	*
 	*  This function is coded so that only one thread can update the ThreadManager at a given time.
 	*  If another ThreadValue calls this function, that means that it has exceeded its Threshold. Thus, it waits for the
-	*  first thread to return from the function, blocking calls to Increment or Decrement in the meanwhile, then returns.
+	*  first thread to return from the function, then returns.
 	*/
 	inline void UpdateManager();
 	/*!
+	*  \brief Update the ThreadManager in a thread-safe way, waiting for the thread updating it, if any.
+	*
+	*  Unlike UpdateManager(), the update is never skipped : the Callback is always called, so it sees the changes made before the call.
+	*/
+	void ForceUpdateManager();
+	/*!
+	*  \brief Wait for every ThreadValue to end its optimistic read, if any.
+	*
+	*  Memory that was reachable before the call can then be freed, as no optimistic read started before the call still uses it.
+	*/
+	void WaitForOptimisticReads();
+	/*!
 	*  \brief Retrieve the so-called "global value" (= sum of ThreadValues) in a thread-safe way.
 	*
-	*  Holds ValueUniqueLock so no subsequent calls to Increment() or Decrement() can occur for any ThreadValue,
-	*  thus enabling the ability to retrieve the exact global value.
+	*  The ThreadValues are summed without locking, so the calls to Increment() or Decrement() are never delayed.
+	*  The sum is exact for every call which happened before this one : the calls running meanwhile may or may not be counted.
+	* 
+	*  \return The sum of ThreadValues.
+	*/
+	inline uInt GetGlobalValue() const;
+	/*!
+	*  \brief Retrieve the global value (= sum of ThreadValues) computed by the last update, in constant time.
+	*
+	*  Unlike GetGlobalValue(), no ThreadValue is read. Each owned ThreadValue updates the ThreadManager once it moves further from its
+	*  value at the last update than its share of the margins, so the error is bounded by the margins of the last update : the global value
+	*  lies between the "goal" global values returned by the Callback, widened by MAX_ERROR times the upper one.
+	*  The value is not exact even once the calls to Increment() or Decrement() stop.
 	* 
-	*  \return The sum of ThreadValues, including deleted ones, at the time the function is called.
+	*  \return The approximate sum of ThreadValues.
 	*/
-	inline uInt GetGlobalValue();
+	inline uInt ApproximateGlobalValue() const;
 };
 
 class ThreadValue {
 private:
+	// Each field is written by a single thread : the owner thread writes Value and OptimisticRead, the ThreadManager writes the thresholds and SingleWriter.
+	// The State hands the ThreadValue over from a thread to the next one.
+	// Both groups are padded on each side, so neither shares a cache line with the other nor with another ThreadValue.
+	char FrontPadding[CACHE_LINE_SIZE];
 	ALIGNED VOLATILE sInt Value; /*!< Field storing the value, as a signed integer */
-	ALIGNED VOLATILE sInt Threshold; /*!< Threshold used for Increment(), so that it will try to update the ThreadManager if Value exceeds the Threshold */
+	ALIGNED VOLATILE sInt OptimisticRead; /*!< Field set to 1 while the thread reads without locking, 0 otherwise */
 	ThreadManager& Manager; /*!< Reference to a ThreadManager */
+	std::atomic<int> State; /*!< The ThreadValueState of the ThreadValue */
+	ThreadValue* Next; /*!< The next ThreadValue of the ThreadManager */
+	char OwnerPadding[CACHE_LINE_SIZE];
+	ALIGNED VOLATILE sInt Threshold; /*!< Threshold used for Increment(), so that it will try to update the ThreadManager if Value exceeds the Threshold */
+	ALIGNED VOLATILE sInt LowerThreshold; /*!< Threshold used for Decrement(), so that it will try to update the ThreadManager if Value falls below the LowerThreshold */
+	ALIGNED VOLATILE sInt SingleWriter; /*!< Field set to 1 while the Value is modified by a relaxed load and store, 0 otherwise */
+	char ManagerPadding[CACHE_LINE_SIZE];
+	/*!
+	*  \brief Add the signed integer passed as argument to the Value, as set by ThreadManager::SetSingleWriter().
+	*  \return The new Value.
+	*/
+	inline _sInt AddToValue(_sInt const);
 public:
 	/*!
 	*  \brief ThreadValue constructor.
 	*  \param A reference to a ThreadManager object.
+	*  \param The next ThreadValue of the ThreadManager.
 	*
-	*  Calls ThreadManager::ConstructThreadValue(this).
+	*  The ThreadValue is owned by the calling thread, see ThreadManager::AcquireThreadValue().
 	*/
-	ThreadValue(ThreadManager&);
+	ThreadValue(ThreadManager&, ThreadValue*);
 	/*!
-	*  \brief ThreadValue destructor.
-	*
-	*  Calls ThreadManager::DestructThreadValue(this).
+	*  \brief Retrieves the ThreadManager of the ThreadValue.
+	*/
+	inline ThreadManager& GetManager() const;
+	/*!
+	*  \brief Takes the ownership of the ThreadValue if it is released, while holding the ManagerLock.
+	*  \return Whether the ThreadValue was released.
+	*/
+	inline bool TryAcquire();
+	/*!
+	*  \brief Starts releasing the ThreadValue owned by the calling thread, unless the ThreadManager left it to the thread.
+	*  \return Whether the ThreadValue is being released : otherwise, the ThreadValue belongs to the thread.
+	*/
+	inline bool TryRelease();
+	/*!
+	*  \brief Ends releasing the ThreadValue : it may be reused or deleted as soon as the call returns.
+	*/
+	inline void EndRelease();
+	/*!
+	*  \brief Leaves the ThreadValue to its owner thread, if any, waiting for the thread releasing it meanwhile.
+	*  \return Whether the ThreadValue is left to its owner thread : otherwise, it is released and belongs to the ThreadManager.
+	*/
+	inline bool TryOrphan();
+	/*!
+	*  \brief Retrieves whether the ThreadManager left the ThreadValue to its owner thread.
+	*/
+	inline bool IsOrphaned() const;
+	/*!
+	*  \brief Retrieves the next ThreadValue of the ThreadManager.
 	*/
-	~ThreadValue();
+	inline ThreadValue* GetNext() const;
 	/*!
 	*  \brief Increment the Value.
 	*
 	*  This function tries to update the ThreadManager if the Value exceeds the Threshold.
-	*  It also waits for the ThreadManager::ValueUniqueLock to be released (see ThreadManager::GetGlobalValue())
 	*/
 	inline void Increment();
 	/*!
 	*  \brief Decrement the Value.
 	*
-	*  It also waits for the ThreadManager::ValueUniqueLock to be released (see ThreadManager::GetGlobalValue())
+	*  This function tries to update the ThreadManager if the Value falls below the LowerThreshold.
 	*/
 	inline void Decrement();
 	/*!
-	*  \brief Atomically replaces Threshold by (Value + X).
+	*  \brief Add the signed integer passed as argument to the Value, as a single update for several Increment() or Decrement() calls.
+	*/
+	inline void Add(_sInt const);
+	/*!
+	*  \brief Atomically replaces Threshold by (Value + X) and LowerThreshold by (Value - Y).
 	*  \param A signed integer X
+	*  \param A signed integer Y
+	*/
+	inline void AdjustThreadThreshold(_sInt, _sInt);
+	/*!
+	*  \brief Atomically sets whether the Value is modified by a relaxed load and store.
 	*/
-	inline void AdjustThreadThreshold(_sInt);
+	inline void SetSingleWriter(bool);
 	/*!
-	*  \brief Atomically retrieves the Value.
+	*  \brief Atomically retrieves the Value, without ordering : the ThreadManager orders its reads itself.
 	*/
 	inline _sInt GetThreadValue() const;
+	/*!
+	*  \brief Mark the start of an optimistic read, so ThreadManager::WaitForOptimisticReads() waits for it.
+	*
+	*  The subsequent reads cannot be reordered before the mark : the LightFence() here pairs with the HeavyFence() of
+	*  ThreadManager::WaitForOptimisticReads(), so the mark costs no hardware fence where a heavy fence is available.
+	*/
+	inline void BeginOptimisticRead();
+	/*!
+	*  \brief Mark the end of an optimistic read.
+	*/
+	inline void EndOptimisticRead();
+	/*!
+	*  \brief Atomically retrieves whether the thread is reading optimistically.
+	*/
+	inline bool IsReadingOptimistically() const;
 };
 
+inline ThreadManager& ThreadValue::GetManager() const {
+	return Manager;
+}
+
+inline bool ThreadValue::TryAcquire() {
+	// The acquire ordering pairs with EndRelease() : the Value written by the exited thread is read here.
+	auto Expected = int(THREAD_VALUE_RELEASED);
+	return State.compare_exchange_strong(Expected, THREAD_VALUE_OWNED, std::memory_order_acquire, std::memory_order_relaxed);
+}
+
+inline bool ThreadValue::TryRelease() {
+	auto Expected = int(THREAD_VALUE_OWNED);
+	return State.compare_exchange_strong(Expected, THREAD_VALUE_RELEASING, std::memory_order_acquire, std::memory_order_acquire);
+}
+
+inline void ThreadValue::EndRelease() {
+	State.store(THREAD_VALUE_RELEASED, std::memory_order_release);
+}
+
+inline bool ThreadValue::TryOrphan() {
+	auto Expected = int(THREAD_VALUE_OWNED);
+	while (!State.compare_exchange_weak(Expected, THREAD_VALUE_ORPHANED, std::memory_order_acq_rel, std::memory_order_acquire)) {
+		if (Expected == THREAD_VALUE_RELEASED) {
+			return false;
+		}
+		if (Expected == THREAD_VALUE_RELEASING) {
+			std::this_thread::yield();
+		}
+		Expected = THREAD_VALUE_OWNED;
+	}
+	return true;
+}
+
+inline bool ThreadValue::IsOrphaned() const {
+	return State.load(std::memory_order_acquire) == THREAD_VALUE_ORPHANED;
+}
+
+inline ThreadValue* ThreadValue::GetNext() const {
+	return Next;
+}
+
 inline _sInt ThreadValue::GetThreadValue() const {
-	return ATOMIC_READ(Value);
+	return RELAXED_READ(Value);
+}
+
+inline void ThreadValue::AdjustThreadThreshold(_sInt Adjustment, _sInt LowerAdjustment) {
+	auto CurrentValue = RELAXED_READ(Value);
+	ATOMIC_WRITE(Threshold, CurrentValue + Adjustment);
+	ATOMIC_WRITE(LowerThreshold, CurrentValue - LowerAdjustment);
+}
+
+inline void ThreadValue::BeginOptimisticRead() {
+	ATOMIC_WRITE(OptimisticRead, 1);
+	LightFence();
+}
+
+inline void ThreadValue::EndOptimisticRead() {
+	ATOMIC_WRITE(OptimisticRead, 0);
 }
 
-inline void ThreadValue::AdjustThreadThreshold(_sInt Adjustment) {
-	ATOMIC_WRITE(Threshold, ATOMIC_READ(Value) + Adjustment);
+inline void ThreadValue::SetSingleWriter(bool const _SingleWriter) {
+	ATOMIC_WRITE(SingleWriter, _SingleWriter ? 1 : 0);
+}
+
+inline bool ThreadValue::IsReadingOptimistically() const {
+	return ATOMIC_READ(OptimisticRead) != 0;
+}
+
+inline _sInt ThreadValue::AddToValue(_sInt const Delta) {
+	// Only this thread writes the Value : the ThreadManager reads it, but never modifies it.
+	if (RELAXED_READ(SingleWriter)) {
+		auto NewValue = RELAXED_READ(Value) + Delta;
+		RELAXED_WRITE(Value, NewValue);
+		return NewValue;
+	}
+	ADD(Value, Delta);
+	return RELAXED_READ(Value);
 }
 
 inline void ThreadValue::Increment() {
 	// Try to update when the Threshold is exceeded.
-	if (INCREMENT(Value) >= ATOMIC_READ(Threshold)) {
+	if (AddToValue(1) >= RELAXED_READ(Threshold)) {
 		Manager.UpdateManager();
 	}
-	// Used by GetGlobalValue() to retrieve the exact Global Value. 
-	Manager.WaitForGlobalValue();
 }
 
 inline void ThreadValue::Decrement() {
-	DECREMENT(Value);
-	// Used by GetGlobalValue() to retrieve the exact Global Value. 
-	Manager.WaitForGlobalValue();
+	// Try to update when the Value falls below the LowerThreshold.
+	if (AddToValue(-1) <= RELAXED_READ(LowerThreshold)) {
+		Manager.UpdateManager();
+	}
 }
 
-ThreadValue::ThreadValue(ThreadManager& _Manager) : Value(0), Manager(_Manager) {
-	Manager.ConstructThreadValue(this);
+inline void ThreadValue::Add(_sInt const Delta) {
+	// Try to update when the Value exceeds the Threshold or falls below the LowerThreshold.
+	auto NewValue = AddToValue(Delta);
+	if (NewValue >= RELAXED_READ(Threshold) || NewValue <= RELAXED_READ(LowerThreshold)) {
+		Manager.UpdateManager();
+	}
 }
 
-ThreadValue::~ThreadValue() {
-	Manager.DestructThreadValue(this);
+ThreadValue::ThreadValue(ThreadManager& _Manager, ThreadValue* _Next) : Value(0), OptimisticRead(0), Manager(_Manager), State(THREAD_VALUE_OWNED), Next(_Next), Threshold(0), LowerThreshold(0), SingleWriter(_Manager.SingleWriterValues ? 1 : 0) {
 }
 
 template<class Fn>
@@ -206,48 +424,164 @@ void ThreadManager::SetCallback(Fn && fn) {
 	Callback = fn;
 }
 
-void ThreadManager::DestructThreadValue(ThreadValue* pThreadValue) {
+template<class Fn>
+inline void ThreadManager::ForEachThreadValue(Fn&& fn) const {
+	for (auto pThrValue = FirstThreadValue.load(std::memory_order_acquire); pThrValue; pThrValue = pThrValue->GetNext()) {
+		fn(*pThrValue);
+	}
+}
+
+void ThreadManager::SetSingleWriter(bool const SingleWriter) {
 	ManagerLock.lock();
-	// Find the correct ThreadValue.
-	auto itThreadValue = std::move(std::find_if(ThreadValues.begin(), ThreadValues.end(), [pThreadValue](ThreadValue* _p) -> bool {
-		return (_p == pThreadValue);
-	}));
-	// Atomically retrieve its value and delete it from the ThreadValues vector.
-	DTOR_ThreadValuesSum += (*itThreadValue)->GetThreadValue();
-	std::swap(*itThreadValue, ThreadValues.back());
-	ThreadValues.pop_back();
+	SingleWriterValues = SingleWriter;
+	ForEachThreadValue([SingleWriter](ThreadValue& ThrValue) {
+		ThrValue.SetSingleWriter(SingleWriter);
+	});
 	ManagerLock.unlock();
 }
 
+void ThreadManager::DeleteThreadValues() {
+	// Leave the owned ThreadValues to their thread first : a thread releasing its ThreadValue meanwhile walks the list, so none is deleted until it is done.
+	std::vector<ThreadValue*> Released;
+	ForEachThreadValue([&](ThreadValue& ThrValue) {
+		if (!ThrValue.TryOrphan()) {
+			Released.push_back(&ThrValue);
+		}
+	});
+	FirstThreadValue.store(nullptr, std::memory_order_relaxed);
+	ThreadValueCount = 0U;
+	for (auto pThrValue : Released) {
+		delete pThrValue;
+	}
+}
+
+ThreadManager::OwnedThreadValues::~OwnedThreadValues() {
+	// The thread exits : release its ThreadValues, or delete those left to it by their destroyed ThreadManager.
+	for (auto& Entry : Entries) {
+		auto& ThrValue = *Entry.second;
+		if (!ThrValue.TryRelease()) {
+			delete &ThrValue;
+			continue;
+		}
+		ThrValue.GetManager().ReleaseThreadValue();
+		ThrValue.EndRelease();
+	}
+}
+
 void ThreadManager::_UpdateManagerInternal() {
 	// Compute the Global Value.
 	_sInt ThreadValuesSum = 0;
-	std::for_each(ThreadValues.begin(), ThreadValues.end(), [&](ThreadValue *& ThrValue) {
-		ThreadValuesSum += ThrValue->GetThreadValue();
+	ForEachThreadValue([&](ThreadValue& ThrValue) {
+		ThreadValuesSum += ThrValue.GetThreadValue();
 	});
-	auto GlobalValue = uInt(ThreadValuesSum + DTOR_ThreadValuesSum);
-	// The Callback() function is in charge of computing the new Threshold based on the Global Value.
-	auto Threshold = Callback(GlobalValue);
+	auto GlobalValue = uInt(std::max(ThreadValuesSum, _sInt(0)));
+	LastGlobalValue.store(GlobalValue, std::memory_order_relaxed);
+	// No ThreadValue has a threshold to adjust.
+	if (!ThreadValueCount) {
+		return;
+	}
+	// The Callback() function is in charge of computing the new Thresholds based on the Global Value.
+	auto Thresholds = Callback(GlobalValue);
+	auto Threshold = Thresholds.second;
 	auto NewMargin = std::max(_sInt(Threshold - GlobalValue),
 		// Optimal margin when the work is properly balanced within threads.
 		_sInt(Threshold * MAX_ERROR))
 		// However it tends to converge quickly, so we impose a minimal change within Updates.
-		/ uInt(ThreadValues.size());
+		/ ThreadValueCount;
+	// Same for the lower "goal" global value.
+	auto NewLowerMargin = std::max(_sInt(GlobalValue - Thresholds.first), _sInt(Threshold * MAX_ERROR))
+		/ ThreadValueCount;
 	// Adjust ThreadValues thresholds.
-	std::for_each(ThreadValues.begin(), ThreadValues.end(), [NewMargin](ThreadValue *& ThrValue) {
-		ThrValue->AdjustThreadThreshold(NewMargin);
+	ForEachThreadValue([NewMargin, NewLowerMargin](ThreadValue& ThrValue) {
+		ThrValue.AdjustThreadThreshold(NewMargin, NewLowerMargin);
+	});
+}
+
+void ThreadManager::ForceUpdateManager() {
+	ManagerLock.lock();
+	_UpdateManagerInternal();
+	ManagerLock.unlock();
+}
+
+void ThreadManager::WaitForOptimisticReads() {
+	// Either a marked thread's mark is read below, or the thread reads what was stored before the call once marked.
+	HeavyFence();
+	ForEachThreadValue([](ThreadValue& ThrValue) {
+		while (ThrValue.IsReadingOptimistically()) {
+			std::this_thread::yield();
+		}
 	});
 }
 
-void ThreadManager::ConstructThreadValue(ThreadValue* pThreadValue) {
+ThreadValue& ThreadManager::AcquireThreadValue() {
+	// The thread may already own a ThreadValue, evicted from its cache by other ThreadManagers.
+	// Meanwhile, delete the ThreadValues left to the thread by the destroyed ThreadManagers.
+	auto& Owned = LocalOwnedValues().Entries;
+	ThreadValue* pOwned = nullptr;
+	Owned.erase(std::remove_if(Owned.begin(), Owned.end(), [&](std::pair<uInt, ThreadValue*> const& Entry) -> bool {
+		if (Entry.first == Id) {
+			pOwned = Entry.second;
+		}
+		else if (Entry.second->IsOrphaned()) {
+			delete Entry.second;
+			return true;
+		}
+		return false;
+	}), Owned.end());
+	if (pOwned) {
+		return *pOwned;
+	}
+	Owned.reserve(Owned.size() + 1U);
 	ManagerLock.lock();
-	// Insert the new ThreadValue and update the manager 
+	// Reuse the ThreadValue released by an exited thread, if any, otherwise insert a new one, and update the manager
 	// (as the thread count increases, the threshold must decrease so we don't exceed the set "goal" Global Value) 
-	ThreadValues.push_back(pThreadValue);
+	auto pThrValue = FirstThreadValue.load(std::memory_order_relaxed);
+	while (pThrValue && !pThrValue->TryAcquire()) {
+		pThrValue = pThrValue->GetNext();
+	}
+	if (!pThrValue) {
+		pThrValue = new ThreadValue(*this, FirstThreadValue.load(std::memory_order_relaxed));
+		FirstThreadValue.store(pThrValue, std::memory_order_release);
+	}
+	++ThreadValueCount;
+	_UpdateManagerInternal();
+	ManagerLock.unlock();
+	Owned.emplace_back(Id, pThrValue);
+	return *pThrValue;
+}
+
+void ThreadManager::ReleaseThreadValue() {
+	ManagerLock.lock();
+	--ThreadValueCount;
 	_UpdateManagerInternal();
 	ManagerLock.unlock();
 }
 
+inline ThreadValue& ThreadManager::LocalValue() {
+	// The Ids are never reused : a cached entry cannot refer to the ThreadValue of another ThreadManager.
+	// The entries are ordered from the most recently used one, so a thread using a single ThreadManager checks a single entry.
+	static thread_local std::pair<uInt, ThreadValue*> Cache[THREAD_VALUE_CACHE_SIZE];
+	if (Cache[0].first == Id) {
+		return *Cache[0].second;
+	}
+	size_t EntryIdx = 1U;
+	while (EntryIdx < THREAD_VALUE_CACHE_SIZE && Cache[EntryIdx].first != Id) {
+		++EntryIdx;
+	}
+	std::pair<uInt, ThreadValue*> Entry;
+	if (EntryIdx < THREAD_VALUE_CACHE_SIZE) {
+		Entry = Cache[EntryIdx];
+	}
+	else {
+		// Evict the least recently used entry.
+		EntryIdx = THREAD_VALUE_CACHE_SIZE - 1;
+		Entry = std::make_pair(Id, &AcquireThreadValue());
+	}
+	std::move_backward(Cache, Cache + EntryIdx, Cache + EntryIdx + 1);
+	Cache[0] = Entry;
+	return *Entry.second;
+}
+
 inline void ThreadManager::UpdateManager() {
 	// If a thread is already updating, don't update, but rather wait.
 	// This is done because if a thread is calling UpdateManager(), that means
@@ -262,21 +596,18 @@ inline void ThreadManager::UpdateManager() {
 	}
 }
 
-inline uInt ThreadManager::GetGlobalValue() {
-	// The ValueUniqueLock is used so no further calls to Increment/Decrement can be issued, thus
-	// allowing for exact retrieval of the sum of ThreadValues::Value.
-	ValueUniqueLock.lock();
-	ManagerLock.lock();
+inline uInt ThreadManager::GetGlobalValue() const {
+	// The fence orders the reads after every Increment/Decrement which happened before the call.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
 	// Compute the sum. 
 	_sInt ThreadValuesSum = 0;
-	std::for_each(ThreadValues.begin(), ThreadValues.end(), [&](ThreadValue *& ThrValue) {
-		ThreadValuesSum += ThrValue->GetThreadValue();
+	ForEachThreadValue([&](ThreadValue& ThrValue) {
+		ThreadValuesSum += ThrValue.GetThreadValue();
 	});
-	ManagerLock.unlock();
-	ValueUniqueLock.unlock();
-	return uInt(ThreadValuesSum + DTOR_ThreadValuesSum);
+	// A Decrement counted without the Increment it follows, from another thread, may bring the sum below zero.
+	return uInt(std::max(ThreadValuesSum, _sInt(0)));
 }
 
-inline void ThreadManager::WaitForGlobalValue() const {
-	while (ValueUniqueLock.owns_lock());
+inline uInt ThreadManager::ApproximateGlobalValue() const {
+	return LastGlobalValue.load(std::memory_order_relaxed);
 }
\ No newline at end of file